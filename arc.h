@@ -28,303 +28,5786 @@
 #ifndef ARC_H
 #define ARC_H
 
+#include <algorithm>
 #include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
 #include <iostream>
+#include <iterator>
+#include <limits>
 #include <memory>
+#include <memory_resource>
 #include <mutex>
+#include <new>
+#include <optional>
 #include <shared_mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
 #include <thread>
+#include <type_traits>
+#include <typeinfo>
+#include <utility>
+#include <variant>
 #include <vector>
 
+#ifdef ARC_STATS
+#if __has_include(<cxxabi.h>)
+#include <cxxabi.h>
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#endif
+
+#if defined(__SANITIZE_THREAD__)
+#define ARC_TSAN 1
+#elif defined(__has_feature)
+#if __has_feature(thread_sanitizer)
+#define ARC_TSAN 1
+#endif
+#endif
+
 /**
  * @brief ARC (Atomic Reference Counting) Smart Pointer Implementation
  *
  * This header file contains the implementation of ARC (Atomic Reference
  * Counting) smart pointer. It provides two classes: `Arc` and `WeakArc`, which
  * enable shared ownership and weak references to an object, respectively.
+ * Both take a counting policy, and `Rc`/`WeakRc` are the non-atomic variants
+ * for data that never leaves one thread.
  *
  * The ARC smart pointer uses a reference count to keep track of the number of
  * references to an object and deletes the object when the reference count
  * reaches zero.
  */
 
-// Forward declaration of WeakArc class
-template <typename T> class WeakArc;
+/**
+ * @brief Cache line size assumed wherever data is padded to avoid false
+ * sharing.
+ *
+ * Fixed rather than `std::hardware_destructive_interference_size`, which
+ * follows tuning flags and would let the layout of the same type differ
+ * between translation units.
+ */
+inline constexpr std::size_t kArcCacheLine = 64;
 
 /**
- * @brief Arc class
+ * @brief Acquire fence taken after the release decrement that dropped the
+ * last reference, so the caller sees every write made by earlier owners.
  *
- * The Arc class provides shared ownership of an object. It uses reference
- * counting to manage the object's lifetime. Multiple Arc instances can point to
- * the same object, and the object is deleted when the last Arc instance goes
- * out of scope.
+ * ThreadSanitizer does not model standalone fences and reports the object's
+ * destruction as racing with those writes. Under it, the fence becomes an
+ * acquire load of the decremented count, which synchronizes with the same
+ * release sequence at the cost of one extra load.
  *
- * @tparam T The type of the object being managed.
+ * @param count The atomic that was decremented.
  */
-template <typename T> class Arc {
-private:
+template <typename Atomic> inline void arc_acquire_fence(const Atomic &count) {
+#ifdef ARC_TSAN
+  (void)count.load(std::memory_order_acquire);
+#else
+  (void)count;
+  std::atomic_thread_fence(std::memory_order_acquire);
+#endif
+}
+
+/**
+ * @brief Overflow policies for the atomic counting policies.
+ *
+ * - `ArcOverflowUnchecked` does nothing; counts are assumed never to get
+ *   near the limit of their type. This is the default.
+ * - `ArcOverflowAbort` calls `std::abort` once a count passes half of its
+ *   type's range, as Rust's `Arc` does.
+ * - `ArcOverflowSaturate` pins such a count in the upper part of the range
+ *   instead, like Linux's `refcount_t`: the object becomes immortal and is
+ *   leaked rather than freed while still referenced.
+ *
+ * The policy is chosen at compile time; unchecked counts compile to the same
+ * code as before.
+ */
+struct ArcOverflowUnchecked {};
+struct ArcOverflowAbort {};
+struct ArcOverflowSaturate {};
+
+/**
+ * @brief Tag selecting the constructor of a counting policy that starts out
+ * saturated, for the blocks of `ImmortalArc`.
+ */
+struct ArcImmortalTag {
+  explicit constexpr ArcImmortalTag() = default;
+};
+
+/**
+ * @brief Tag selecting the Arc constructor that adopts a strong reference
+ * added beforehand with `Arc::retain`.
+ */
+struct ArcAdoptTag {
+  explicit constexpr ArcAdoptTag() = default;
+};
+
+/**
+ * @brief Range checks shared by the atomic counting policies.
+ *
+ * @tparam Int Integer type of the count.
+ * @tparam Overflow One of the overflow policies.
+ */
+template <typename Int, typename Overflow> struct ArcOverflow {
+  static_assert(std::is_same_v<Overflow, ArcOverflowUnchecked> ||
+                    std::is_same_v<Overflow, ArcOverflowAbort> ||
+                    std::is_same_v<Overflow, ArcOverflowSaturate>,
+                "Unknown overflow policy");
+
+  static constexpr bool kChecked =
+      !std::is_same_v<Overflow, ArcOverflowUnchecked>;
+  static constexpr bool kSaturate =
+      std::is_same_v<Overflow, ArcOverflowSaturate>;
+
+  // Counts at or above the limit have overflowed. Saturated counts are pinned
+  // halfway between the limit and the top of the range, so updates racing
+  // with the pinning cannot leave the saturated zone.
+  static constexpr Int kLimit = std::numeric_limits<Int>::max() / 2;
+  static constexpr Int kSaturated = kLimit + kLimit / 2;
+
   /**
-   * @brief Struct representing the control block for an Arc instance.
+   * @brief Check a count read by an update.
    *
-   * The control block holds the reference count, a mutex for thread safety,
-   * and a shared pointer to the data.
+   * @param old Value of the count before the update.
+   * @return True if the count is saturated and the update must be undone by
+   * pinning it again.
    */
-  struct ArcControlBlock {
-    std::atomic<int> ref_count; // Reference count
-    std::shared_mutex mutex;    // Mutex for thread-safe access
-    std::shared_ptr<T> data;    // Shared pointer to data
+  static bool overflowed(Int old) {
+    if constexpr (kChecked) {
+      if (old >= kLimit) {
+        if constexpr (!kSaturate) {
+          std::abort();
+        }
+        return true;
+      }
+    }
+    return false;
+  }
+};
 
-    /**
-     * @brief Constructor to initialize the control block.
-     *
-     * @param ptr Pointer to the object being managed by Arc.
-     */
-    ArcControlBlock(T *ptr) : ref_count(1), data(ptr, [](T *p) { delete p; }) {}
-  };
+/**
+ * @brief BasicAtomicCount counting policy
+ *
+ * Keeps the strong and weak reference counts of a control block in atomic
+ * integers, so Arc instances sharing the block can be copied and dropped from
+ * any thread. `AtomicCount`, the default policy of Arc, is
+ * `BasicAtomicCount<int>`.
+ *
+ * Following Rust's `Arc`, all strong references together hold one implicit
+ * weak reference, released when the strong count drops to zero.
+ *
+ * @tparam Int Integer type of each count, such as `std::uint32_t` or
+ * `std::uint64_t`.
+ * @tparam Overflow Overflow policy; see `ArcOverflowUnchecked`.
+ */
+template <typename Int = int, typename Overflow = ArcOverflowUnchecked>
+class BasicAtomicCount {
+private:
+  static_assert(std::is_integral_v<Int>, "Counts are integers");
 
-  // Friend declarations
-  friend struct WeakArcControlBlock; // Allow access to WeakArcControlBlock
-  friend class WeakArc<T>;           // Allow access to WeakArc class
+  using Check = ArcOverflow<Int, Overflow>;
+
+  // Weak count held by `is_unique` while it reads the strong count. Above
+  // the saturated zone, so no real count ever reaches it.
+  static constexpr Int kWeakLocked = std::numeric_limits<Int>::max();
 
-  ArcControlBlock *control_block; // Pointer to the control block
+  std::atomic<Int> strong; // Strong reference count
+  std::atomic<Int> weak;   // Weak references, plus one for all strong
+
+  static void saturate(std::atomic<Int> &count) {
+    count.store(Check::kSaturated, std::memory_order_relaxed);
+  }
 
 public:
+  constexpr BasicAtomicCount() : strong(1), weak(1) {}
+
   /**
-   * @brief Constructor to create an Arc instance.
-   *
-   * @param ptr Pointer to the object being managed by Arc.
+   * @brief Construct saturated counts, which never reach zero.
    */
-  explicit Arc(T *ptr) : control_block(new ArcControlBlock(ptr)) {}
+  constexpr explicit BasicAtomicCount(ArcImmortalTag)
+      : strong(Check::kSaturated), weak(Check::kSaturated) {}
 
   /**
-   * @brief Copy constructor.
-   *
-   * Increments the reference count of the control block.
+   * @brief Add strong references.
    *
-   * @param other The Arc instance to copy.
+   * @param count Number of references to add.
    */
-  Arc(const Arc &other) : control_block(other.control_block) {
-    control_block->ref_count.fetch_add(1, std::memory_order_relaxed);
+  void increment(int count = 1) {
+    auto old = strong.fetch_add(Int(count), std::memory_order_relaxed);
+    if (Check::overflowed(old)) {
+      saturate(strong);
+    }
   }
 
   /**
-   * @brief Assignment operator.
-   *
-   * Decrements the reference count of the current control block and acquires
-   * locks on both the current and other control blocks. Then assigns the other
-   * control block and increments its reference count.
+   * @brief Drop strong references.
    *
-   * @param other The Arc instance to assign.
-   * @return Reference to the assigned Arc instance.
+   * @param count Number of references to drop.
+   * @return True if these were the last strong references, in which case all
+   * prior writes to the object are visible to the caller.
    */
-  auto operator=(const Arc &other) {
-    if (this != &other) {
-      std::lock(control_block->mutex, other.control_block->mutex);
-      std::lock_guard<std::shared_mutex> self_lock(control_block->mutex,
-                                                   std::adopt_lock);
-      std::lock_guard<std::shared_mutex> other_lock(other.control_block->mutex,
-                                                    std::adopt_lock);
-
-      release();
-      control_block = other.control_block;
-      control_block->ref_count.fetch_add(1, std::memory_order_relaxed);
+  bool decrement(int count = 1) {
+    auto old = strong.fetch_sub(Int(count), std::memory_order_release);
+    if constexpr (Check::kSaturate) {
+      if (old >= Check::kLimit) {
+        saturate(strong);
+        return false;
+      }
     }
-    return *this;
+    if (old == Int(count)) {
+      arc_acquire_fence(strong);
+      return true;
+    }
+    return false;
   }
 
   /**
-   * @brief Destructor.
+   * @brief Add a strong reference unless the object is already gone.
    *
-   * Decrements the reference count of the control block and releases the
-   * control block if the reference count reaches zero.
+   * @return True if a reference was added.
    */
-  ~Arc() { release(); }
+  bool try_increment() {
+    auto count = strong.load(std::memory_order_relaxed);
+    while (count != 0) {
+      if (Check::overflowed(count)) {
+        return true; // Saturated objects are never freed
+      }
+      if (strong.compare_exchange_weak(count, count + 1,
+                                       std::memory_order_acquire,
+                                       std::memory_order_relaxed)) {
+        return true;
+      }
+    }
+    return false;
+  }
 
   /**
-   * @brief Get the raw pointer to the managed object.
+   * @brief Add a weak reference.
    *
-   * @return Pointer to the managed object.
+   * Waits while `is_unique` holds the weak count locked, as Rust's
+   * `Arc::downgrade` does, so that a strong reference cannot become a weak
+   * one between its two loads.
    */
-  auto get() const { return control_block->data.get(); }
+  void increment_weak() {
+    auto old = weak.load(std::memory_order_relaxed);
+    do {
+      while (old == kWeakLocked) {
+        std::this_thread::yield();
+        old = weak.load(std::memory_order_relaxed);
+      }
+      if (Check::overflowed(old)) {
+        saturate(weak);
+        return;
+      }
+    } while (!weak.compare_exchange_weak(old, old + 1,
+                                         std::memory_order_acquire,
+                                         std::memory_order_relaxed));
+  }
 
   /**
-   * @brief Get the mutex associated with the control block.
+   * @brief Drop a weak reference.
    *
-   * @return Pointer to the shared_mutex object.
+   * A weak count of one means the caller holds the only reference left of
+   * any kind, so nobody else can change it and no atomic update is needed.
+   *
+   * @return True if this was the last weak reference.
    */
-  auto mutex() { return &control_block->mutex; }
+  bool decrement_weak() {
+    if (weak.load(std::memory_order_acquire) == 1) {
+      return true;
+    }
+    auto old = weak.fetch_sub(1, std::memory_order_release);
+    if constexpr (Check::kSaturate) {
+      if (old >= Check::kLimit) {
+        saturate(weak);
+        return false;
+      }
+    }
+    if (old == 1) {
+      arc_acquire_fence(weak);
+      return true;
+    }
+    return false;
+  }
 
   /**
-   * @brief Create a clone of the Arc object.
-   *
-   * Acquires a shared lock on the control block's mutex and creates a new
-   * Arc object with the same control block.
+   * @brief Get the current number of strong references.
    *
-   * @return Cloned Arc object.
+   * @return The strong reference count.
    */
-  auto clone() const {
-    std::shared_lock<std::shared_mutex> lock(control_block->mutex);
-    return Arc(*this);
-  }
+  Int use_count() const { return strong.load(std::memory_order_relaxed); }
 
   /**
-   * @brief Get mutable access to the data.
+   * @brief Check whether the caller's strong reference is the only reference.
    *
-   * Allows a mutable reference to the data by acquiring a lock on the
-   * associated mutex.
+   * Two plain loads are not enough: between them, another owner could
+   * downgrade, drop its strong reference and keep a weak one to upgrade
+   * later. As in Rust's `Arc::is_unique`, the weak count is locked while the
+   * strong count is read, so no strong reference can become a weak one in
+   * the meantime.
    *
-   * @tparam U Type of the object.
-   * @param arc The Arc instance.
-   * @return Mutable pointer to the data.
+   * @return True if there is one strong reference and no weak ones, in which
+   * case all prior writes to the object are visible to the caller.
    */
-  template <typename U> friend U *get_mut(Arc<U> &arc);
+  bool is_unique() {
+    Int expected = 1;
+    if (!weak.compare_exchange_strong(expected, kWeakLocked,
+                                      std::memory_order_acquire,
+                                      std::memory_order_relaxed)) {
+      return false;
+    }
+    bool unique = strong.load(std::memory_order_acquire) == 1;
+    weak.store(1, std::memory_order_release);
+    return unique;
+  }
+};
+
+/**
+ * @brief AtomicCount counting policy
+ *
+ * The default policy of Arc: `int` counts with no overflow checks.
+ */
+using AtomicCount = BasicAtomicCount<>;
 
+/**
+ * @brief PackedAtomicCount counting policy
+ *
+ * Packs a 32-bit strong count and a 32-bit weak count into one 64-bit atomic
+ * word, so both can be read or updated by a single atomic operation. The
+ * uniqueness check behind `make_mut` is a single load, and a block's counts
+ * take eight bytes.
+ *
+ * @tparam Overflow Overflow policy; see `ArcOverflowUnchecked`.
+ */
+template <typename Overflow = ArcOverflowUnchecked> class PackedAtomicCount {
 private:
+  using Check = ArcOverflow<std::uint32_t, Overflow>;
+
+  static constexpr int kWeakShift = 32;
+  static constexpr std::uint64_t kStrongMask = 0xffffffffu;
+  static constexpr std::uint64_t kWeakOne = std::uint64_t(1) << kWeakShift;
+
+  std::atomic<std::uint64_t> word; // Weak count above, strong count below
+
+  static std::uint32_t strong_of(std::uint64_t value) {
+    return static_cast<std::uint32_t>(value & kStrongMask);
+  }
+
+  static std::uint32_t weak_of(std::uint64_t value) {
+    return static_cast<std::uint32_t>(value >> kWeakShift);
+  }
+
   /**
-   * @brief Release the Arc's control block and delete it if necessary.
+   * @brief Pin an overflowed half of the word, leaving the other alone.
    *
-   * Decrements the reference count of the control block and deletes the control
-   * block if the reference count reaches zero.
+   * @param weak True to pin the weak count, false for the strong count.
    */
-  void release() {
-    if (control_block &&
-        control_block->ref_count.fetch_sub(1, std::memory_order_release) == 1) {
+  void saturate(bool weak) {
+    auto value = word.load(std::memory_order_relaxed);
+    std::uint64_t desired;
+    do {
+      desired = weak ? (value & kStrongMask) |
+                           (std::uint64_t(Check::kSaturated) << kWeakShift)
+                     : (value & ~kStrongMask) | Check::kSaturated;
+    } while (!word.compare_exchange_weak(value, desired,
+                                         std::memory_order_relaxed));
+  }
+
+public:
+  constexpr PackedAtomicCount() : word(kWeakOne | 1) {}
+
+  constexpr explicit PackedAtomicCount(ArcImmortalTag)
+      : word(std::uint64_t(Check::kSaturated) << kWeakShift |
+             Check::kSaturated) {}
+
+  void increment(int count = 1) {
+    auto old = word.fetch_add(std::uint64_t(count), std::memory_order_relaxed);
+    if (Check::overflowed(strong_of(old))) {
+      saturate(false);
+    }
+  }
+
+  bool decrement(int count = 1) {
+    auto old = word.fetch_sub(std::uint64_t(count), std::memory_order_release);
+    if constexpr (Check::kSaturate) {
+      if (strong_of(old) >= Check::kLimit) {
+        saturate(false);
+        return false;
+      }
+    }
+    if (strong_of(old) == std::uint32_t(count)) {
+      arc_acquire_fence(word);
+      return true;
+    }
+    return false;
+  }
+
+  bool try_increment() {
+    auto value = word.load(std::memory_order_relaxed);
+    while (strong_of(value) != 0) {
+      if (Check::overflowed(strong_of(value))) {
+        return true; // Saturated objects are never freed
+      }
+      if (word.compare_exchange_weak(value, value + 1,
+                                     std::memory_order_acquire,
+                                     std::memory_order_relaxed)) {
+        return true;
+      }
+    }
+    return false;
+  }
 
-      std::atomic_thread_fence(std::memory_order_acquire);
-      std::lock_guard<std::shared_mutex> lock(control_block->mutex);
+  void increment_weak() {
+    auto old = word.fetch_add(kWeakOne, std::memory_order_relaxed);
+    if (Check::overflowed(weak_of(old))) {
+      saturate(true);
+    }
+  }
 
-      if (control_block->ref_count.load(std::memory_order_relaxed) == 0) {
-        control_block->data.reset();
-        delete control_block;
+  bool decrement_weak() {
+    // As in BasicAtomicCount: a lone weak reference cannot be contended.
+    if (weak_of(word.load(std::memory_order_acquire)) == 1) {
+      return true;
+    }
+    auto old = word.fetch_sub(kWeakOne, std::memory_order_release);
+    if constexpr (Check::kSaturate) {
+      if (weak_of(old) >= Check::kLimit) {
+        saturate(true);
+        return false;
       }
     }
+    if (weak_of(old) == 1) {
+      arc_acquire_fence(word);
+      return true;
+    }
+    return false;
+  }
+
+  std::uint32_t use_count() const {
+    return strong_of(word.load(std::memory_order_relaxed));
+  }
+
+  // Unlike BasicAtomicCount, needs no lock: one load sees both counts at the
+  // same instant, so a racing downgrade shows up in one or the other.
+  bool is_unique() const {
+    return word.load(std::memory_order_acquire) == (kWeakOne | 1);
   }
 };
 
 /**
- * @brief Get mutable access to the data.
+ * @brief LocalCount counting policy
  *
- * Allows a mutable reference to the data by acquiring a lock on the associated
- * mutex.
- *
- * @tparam U Type of the object.
- * @param arc The Arc instance.
- * @return Mutable pointer to the data.
+ * Keeps the strong and weak reference counts in plain integers. Instances
+ * sharing a control block must all be used from a single thread; in exchange
+ * every copy and drop is an ordinary increment or decrement. Used by `Rc`.
  */
-template <typename U> U *get_mut(Arc<U> &arc) {
-  std::lock_guard<std::shared_mutex> lock(*arc.mutex());
-  return arc.get();
-}
+class LocalCount {
+private:
+  int strong; // Strong reference count
+  int weak;   // Weak references, plus one for all strong
+
+public:
+  constexpr LocalCount() : strong(1), weak(1) {}
+
+  constexpr explicit LocalCount(ArcImmortalTag)
+      : strong(std::numeric_limits<int>::max() / 2),
+        weak(std::numeric_limits<int>::max() / 2) {}
+
+  // Same operations as AtomicCount, without atomics or fences.
+
+  void increment(int count = 1) { strong += count; }
+
+  bool decrement(int count = 1) { return (strong -= count) == 0; }
+
+  bool try_increment() {
+    if (strong == 0) {
+      return false;
+    }
+    ++strong;
+    return true;
+  }
+
+  void increment_weak() { ++weak; }
+
+  bool decrement_weak() { return --weak == 0; }
+
+  int use_count() const { return strong; }
+
+  bool is_unique() const { return weak == 1 && strong == 1; }
+};
 
 /**
- * @brief WeakArc class
+ * @brief BiasedCount counting policy
  *
- * The WeakArc class provides weak references to an object managed by Arc.
- * It allows observing the object without keeping it alive. WeakArc can be
- * upgraded to an Arc if the object still exists.
+ * Biased reference counting, as used by Swift and by CPython's free-threaded
+ * build. The thread that creates the object owns it: its copies and drops
+ * update a local count with plain loads and stores. Other threads update an
+ * atomic shared count. The object is destroyed once local + shared reaches
+ * zero, and the two are merged at the points where that can happen:
  *
- * @tparam T The type of the object being managed.
+ * - When the local count drops to zero, the owner folds it into the shared
+ *   count and marks the block merged; from then on every thread uses the
+ *   shared count.
+ * - When a drop on another thread takes the shared count below zero, the
+ *   references it drops were made on the owner. The block is queued for the
+ *   owner, which merges it on its next drop of any biased Arc, on
+ *   `merge_pending()`, or when it exits. If the owner has already exited, the
+ *   dropping thread merges the block itself.
+ *
+ * Owners that keep biased Arcs alive but rarely drop any can call
+ * `merge_pending()` at a convenient point to release objects queued to them.
  */
-template <typename T> class WeakArc {
+class BiasedCount {
 private:
   /**
-   * @brief Struct representing the control block for a WeakArc instance.
+   * @brief Per-thread queue of blocks waiting for their owner to merge them.
    *
-   * The control block holds the reference count and a weak pointer to the data.
+   * Kept alive by the owning thread and by every block it created, so that a
+   * block can always reach its owner's queue.
    */
-  struct WeakArcControlBlock {
-    std::atomic<int> ref_count; // Reference count
-    std::weak_ptr<T> data;      // Weak pointer to data
-
-    /**
-     * @brief Constructor to initialize the control block from an Arc instance.
-     *
-     * @param arc The Arc instance.
-     */
-    WeakArcControlBlock(Arc<T> &arc)
-        : ref_count(1), data(arc.control_block->data) {}
+  struct OwnerQueue {
+    std::atomic<BiasedCount *> head{nullptr}; // Blocks to merge, or closed
+    std::atomic<int> refs{1};                 // Owning thread plus blocks
   };
 
-  WeakArcControlBlock *control_block; // Pointer to the control block
-
-public:
   /**
-   * @brief Constructor to create a WeakArc instance from an Arc instance.
+   * @brief Thread-local handle on the calling thread's queue.
    *
-   * @param arc The Arc instance.
+   * Closes and drains the queue when the thread exits.
    */
-  explicit WeakArc(Arc<T> &arc) : control_block(new WeakArcControlBlock(arc)) {}
+  struct ThreadOwner {
+    OwnerQueue *queue = new OwnerQueue;
+
+    ThreadOwner() { current_queue() = queue; }
+
+    ~ThreadOwner() {
+      // Blocks queued from now on are merged by the thread that drops them.
+      current_queue() = nullptr;
+      drain(queue->head.exchange(closed(), std::memory_order_acq_rel));
+      if (queue->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        delete queue;
+      }
+    }
+  };
+
+  // Flags kept in the low bits of the shared count.
+  static constexpr std::int64_t kMerged = 1;
+  static constexpr std::int64_t kQueued = 2;
+  static constexpr int kFlagBits = 2;
+
+  // Weak count held by `is_unique`, as in BasicAtomicCount.
+  static constexpr int kWeakLocked = -1;
+
+  OwnerQueue *owner;                // Queue of the creating thread
+  std::atomic<int> local;           // Owner's count, written by owner only
+  std::atomic<std::int64_t> shared; // Other threads' count, shifted, + flags
+  std::atomic<int> weak;            // Weak references, plus one for all strong
+  bool merged;                      // Set by the owner once it has merged
+  BiasedCount *next_queued;         // Link in the owner's queue
+
+  static OwnerQueue *&current_queue() {
+    thread_local OwnerQueue *queue = nullptr;
+    return queue;
+  }
+
+  static OwnerQueue *thread_owner() {
+    thread_local ThreadOwner owner;
+    return current_queue();
+  }
+
+  static BiasedCount *closed() {
+    return reinterpret_cast<BiasedCount *>(std::uintptr_t(1));
+  }
+
+  // `merged` is only ever touched by the owner, so test ownership first.
+  bool owned_here() const { return owner == current_queue() && !merged; }
 
   /**
-   * @brief Copy constructor.
+   * @brief Fold the local count into the shared count.
    *
-   * Increments the reference count of the control block.
+   * Runs on the owner, or on any thread once the owner has exited.
+   * Nothing may touch the block after the update that sets `kMerged`: from
+   * then on a drop on another thread can take the count to zero and free
+   * it.
    *
-   * @param other The WeakArc instance to copy.
+   * @return True if no references are left.
    */
-  WeakArc(const WeakArc &other) : control_block(other.control_block) {
-    control_block->ref_count.fetch_add(1, std::memory_order_relaxed);
+  bool merge() {
+    // The merging thread is the only writer of the local count, so it can
+    // be emptied first.
+    auto moved = std::int64_t(local.load(std::memory_order_relaxed))
+                 << kFlagBits;
+    local.store(0, std::memory_order_relaxed);
+    auto old = shared.load(std::memory_order_relaxed);
+    std::int64_t desired;
+    do {
+      desired = (old + moved) | kMerged;
+    } while (!shared.compare_exchange_weak(old, desired,
+                                           std::memory_order_acq_rel,
+                                           std::memory_order_relaxed));
+    return (desired >> kFlagBits) == 0;
   }
 
   /**
-   * @brief Assignment operator.
+   * @brief Merge a list of blocks taken from an owner's queue.
    *
-   * Decrements the reference count of the current control block and assigns
-   * the other control block, incrementing its reference count.
+   * Destroys the objects that have no references left.
    *
-   * @param other The WeakArc instance to assign.
-   * @return Reference to the assigned WeakArc instance.
+   * @param block First block of the list, linked through `next_queued`.
    */
-  auto operator=(const WeakArc &other) {
-    if (this != &other) {
-      control_block = other.control_block;
-      control_block->ref_count.fetch_add(1, std::memory_order_relaxed);
-    }
-    return *this;
-  }
+  static void drain(BiasedCount *block);
 
   /**
-   * @brief Destructor.
-   *
-   * Decrements the reference count of the control block and releases the
-   * control block if the reference count reaches zero.
+   * @brief Drop a weak reference taken by `decrement` that the owner's
+   * queue did not need, freeing the block if it was the last.
    */
-  ~WeakArc() { release(); }
+  void unpin();
 
   /**
-   * @brief Upgrade the WeakArc to a corresponding Arc instance.
-   *
-   * Attempts to upgrade the WeakArc to an Arc instance. If the object still
-   * exists, an Arc instance pointing to the same object is returned. If the
-   * object has been deleted, a nullptr is returned.
+   * @brief Hand a block whose shared count went negative to its owner.
    *
-   * @return Upgraded Arc instance or nullptr.
+   * @return True if the owner has exited, the caller merged the block itself
+   * and no references are left.
    */
-  auto upgrade() const {
-    std::shared_ptr<T> shared_ptr = control_block->data.lock();
-    if (shared_ptr) {
-      return Arc<T>(shared_ptr.get());
+  bool queue_for_owner() {
+    // The weak reference the caller took keeps the block alive while it
+    // sits in the queue.
+    auto head = owner->head.load(std::memory_order_relaxed);
+    do {
+      if (head == closed()) {
+        arc_acquire_fence(owner->head);
+        decrement_weak(); // Cannot be the last: the object is still alive
+        return merge();
+      }
+      next_queued = head;
+    } while (!owner->head.compare_exchange_weak(head, this,
+                                                std::memory_order_release,
+                                                std::memory_order_relaxed));
+    return false;
+  }
+
+public:
+  BiasedCount()
+      : owner(thread_owner()), local(1), shared(0), weak(1), merged(false),
+        next_queued(nullptr) {
+    owner->refs.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  ~BiasedCount() {
+    if (owner->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      delete owner;
+    }
+  }
+
+  BiasedCount(const BiasedCount &) = delete;
+  BiasedCount &operator=(const BiasedCount &) = delete;
+
+  void increment(int count = 1) {
+    if (owned_here()) {
+      local.store(local.load(std::memory_order_relaxed) + count,
+                  std::memory_order_relaxed);
     } else {
-      return Arc<T>(nullptr);
+      shared.fetch_add(std::int64_t(count) << kFlagBits,
+                       std::memory_order_relaxed);
     }
   }
 
-private:
+  bool decrement(int count = 1) {
+    merge_pending();
+    if (owned_here()) {
+      auto remaining = local.load(std::memory_order_relaxed) - count;
+      local.store(remaining, std::memory_order_relaxed);
+      if (remaining != 0) {
+        return false;
+      }
+      merged = true;
+      return merge();
+    }
+
+    auto delta = std::int64_t(count) << kFlagBits;
+    auto old = shared.load(std::memory_order_relaxed);
+    bool pinned = false; // Holds a weak reference for the owner's queue
+    while (!(old & kMerged)) {
+      auto desired = old - delta;
+      bool queue = !(old & kQueued) && (desired >> kFlagBits) < 0;
+      if (queue) {
+        // Once the drop is published the owner may merge and free the
+        // block, so the weak reference the queue needs is taken first.
+        if (!pinned) {
+          increment_weak();
+          pinned = true;
+        }
+        desired |= kQueued;
+      }
+      if (shared.compare_exchange_weak(old, desired,
+                                       std::memory_order_release,
+                                       std::memory_order_relaxed)) {
+        if (queue) {
+          return queue_for_owner();
+        }
+        if (pinned) {
+          unpin();
+        }
+        return false;
+      }
+    }
+    old = shared.fetch_sub(delta, std::memory_order_release);
+    bool last = (old >> kFlagBits) == count;
+    if (last) {
+      arc_acquire_fence(shared);
+    }
+    if (pinned) {
+      unpin(); // Cannot be the last if `last`: the object is still alive
+    }
+    return last;
+  }
+
+  bool try_increment() {
+    if (owned_here()) {
+      increment();
+      return true;
+    }
+    auto old = shared.load(std::memory_order_relaxed);
+    do {
+      if ((old & kMerged) && (old >> kFlagBits) == 0) {
+        return false;
+      }
+    } while (!shared.compare_exchange_weak(
+        old, old + (std::int64_t(1) << kFlagBits), std::memory_order_acquire,
+        std::memory_order_relaxed));
+    return true;
+  }
+
+  void increment_weak() {
+    // Waits while is_unique holds the weak count, as in BasicAtomicCount.
+    auto old = weak.load(std::memory_order_relaxed);
+    do {
+      while (old == kWeakLocked) {
+        std::this_thread::yield();
+        old = weak.load(std::memory_order_relaxed);
+      }
+    } while (!weak.compare_exchange_weak(old, old + 1,
+                                         std::memory_order_acquire,
+                                         std::memory_order_relaxed));
+  }
+
+  bool decrement_weak() {
+    if (weak.fetch_sub(1, std::memory_order_release) == 1) {
+      arc_acquire_fence(weak);
+      return true;
+    }
+    return false;
+  }
+
+  int use_count() const {
+    return static_cast<int>(local.load(std::memory_order_relaxed) +
+                            (shared.load(std::memory_order_relaxed) >>
+                             kFlagBits));
+  }
+
+  bool is_unique() {
+    // The weak count is locked while the counts are read, as in
+    // BasicAtomicCount. A block queued for its owner holds an extra weak
+    // reference, so it is never reported unique.
+    int expected = 1;
+    if (!weak.compare_exchange_strong(expected, kWeakLocked,
+                                      std::memory_order_acquire,
+                                      std::memory_order_relaxed)) {
+      return false;
+    }
+    auto count = shared.load(std::memory_order_acquire);
+    bool unique;
+    if (owned_here()) {
+      unique = local.load(std::memory_order_relaxed) + (count >> kFlagBits) ==
+               1;
+    } else {
+      // The owner updates the local count without ordering, so only a
+      // merged count can be trusted off the owner thread.
+      unique = (count & kMerged) && (count >> kFlagBits) == 1;
+    }
+    weak.store(1, std::memory_order_release);
+    return unique;
+  }
+
   /**
-   * @brief Release the WeakArc's control block and delete it if necessary.
+   * @brief Merge the blocks other threads queued to the calling thread.
    *
-   * Decrements the reference count of the control block and deletes the control
-   * block if the reference count reaches zero.
+   * Objects whose last references were dropped on other threads are
+   * destroyed here.
    */
-  void release() {
-    if (control_block) {
-      if (control_block->ref_count.fetch_sub(1, std::memory_order_release) ==
-          1) {
-        std::atomic_thread_fence(std::memory_order_acquire);
-        delete control_block;
-      }
+  static void merge_pending() {
+    auto queue = current_queue();
+    if (queue && queue->head.load(std::memory_order_relaxed)) {
+      drain(queue->head.exchange(nullptr, std::memory_order_acquire));
     }
   }
 };
 
+/**
+ * @brief ArcPool class
+ *
+ * Opt-in recycling pool for control blocks. Freed blocks go to a per-thread
+ * free list for their size class, so the next allocation on that thread
+ * reuses a warm cache line instead of calling `operator new`. When a thread's
+ * list grows past its limit, half of it is drained as one batch to a global
+ * lock-free stack, where other threads pick it up; producer/consumer patterns
+ * therefore recycle memory instead of piling it up on the consumer.
+ *
+ * Define `ARC_POOL` before including this header to route `make_arc` through
+ * the pool, or pass an `ArcPoolAllocator` to `allocate_arc` to opt in per
+ * call. Pooled memory is kept for reuse and never returned to the system.
+ */
+class ArcPool {
+public:
+  static constexpr std::size_t kGranularity =
+      kArcCacheLine; // Size class step and alignment
+  static constexpr std::size_t kSizeClasses = 8;  // Pooled sizes up to 512
+  static constexpr std::size_t kDefaultThreadCacheLimit = 64;
+
+  /**
+   * @brief Pool counters, summed over all threads.
+   */
+  struct Stats {
+    std::size_t hits;    // Allocations served from a thread cache
+    std::size_t misses;  // Allocations that fell through to operator new
+    std::size_t refills; // Batches taken from the global stack
+    std::size_t drained; // Blocks moved from thread caches to the global stack
+  };
+
+  /**
+   * @brief Allocate a block of at least `size` bytes.
+   *
+   * Sizes beyond the largest size class are passed to `operator new`.
+   *
+   * @param size Requested size in bytes.
+   * @return Pointer to memory aligned to `kGranularity`.
+   */
+  static void *allocate(std::size_t size) {
+    auto size_class = size_class_of(size);
+    if (size_class >= kSizeClasses) {
+      return ::operator new(size, std::align_val_t(kGranularity));
+    }
+
+    auto cache = thread_cache();
+    if (!cache) {
+      return allocate_slow(size_class, nullptr);
+    }
+    auto &list = cache->lists[size_class];
+    if (!list.head) {
+      return allocate_slow(size_class, cache);
+    }
+    auto block = list.head;
+    list.head = block->next;
+    --list.count;
+    bump(cache->hits);
+    return block;
+  }
+
+  /**
+   * @brief Return a block obtained from `allocate`.
+   *
+   * @param ptr The block to recycle.
+   * @param size The size that was passed to `allocate`.
+   */
+  static void deallocate(void *ptr, std::size_t size) noexcept {
+    auto size_class = size_class_of(size);
+    if (size_class >= kSizeClasses) {
+      ::operator delete(ptr, std::align_val_t(kGranularity));
+      return;
+    }
+
+    auto block = static_cast<FreeBlock *>(ptr);
+    auto cache = thread_cache();
+    if (!cache) {
+      block->next = nullptr;
+      push_batch(size_class, block, 1);
+      return;
+    }
+    auto &list = cache->lists[size_class];
+    block->next = list.head;
+    list.head = block;
+    if (++list.count > cache->limit) {
+      drain(cache, list, size_class, list.count - cache->limit / 2);
+    }
+  }
+
+  /**
+   * @brief Set how many free blocks per size class the calling thread keeps.
+   *
+   * @param limit Maximum number of cached blocks; zero disables caching.
+   */
+  static void set_thread_cache_limit(std::size_t limit) {
+    if (auto cache = thread_cache()) {
+      cache->limit = limit;
+      for (std::size_t i = 0; i < kSizeClasses; ++i) {
+        if (cache->lists[i].count > limit) {
+          drain(cache, cache->lists[i], i, cache->lists[i].count - limit);
+        }
+      }
+    }
+  }
+
+  /**
+   * @brief Set the per-thread limit used by threads that touch the pool
+   * after this call.
+   *
+   * @param limit Maximum number of cached blocks per size class.
+   */
+  static void set_default_thread_cache_limit(std::size_t limit) {
+    default_limit.store(limit, std::memory_order_relaxed);
+  }
+
+  /**
+   * @brief Return cached memory to the system.
+   *
+   * Frees the calling thread's free lists and everything on the global
+   * stacks. Must only be called while no other thread is using the pool, for
+   * example at shutdown.
+   */
+  static void trim() {
+    if (auto cache = thread_cache()) {
+      for (std::size_t i = 0; i < kSizeClasses; ++i) {
+        if (cache->lists[i].count) {
+          drain(cache, cache->lists[i], i, cache->lists[i].count);
+        }
+      }
+    }
+    for (std::size_t i = 0; i < kSizeClasses; ++i) {
+      while (auto batch = pop_batch(i)) {
+        while (batch) {
+          auto next = batch->next;
+          ::operator delete(batch, std::align_val_t(kGranularity));
+          batch = next;
+        }
+      }
+    }
+  }
+
+  /**
+   * @brief Get the pool counters, including those of exited threads.
+   *
+   * @return Snapshot of the counters.
+   */
+  static Stats stats() {
+    std::lock_guard<std::mutex> lock(registry_mutex());
+    auto total = retired_stats();
+    for (auto cache = registry_head(); cache; cache = cache->next_registered) {
+      total.hits += cache->hits.load(std::memory_order_relaxed);
+      total.misses += cache->misses.load(std::memory_order_relaxed);
+      total.refills += cache->refills.load(std::memory_order_relaxed);
+      total.drained += cache->drained.load(std::memory_order_relaxed);
+    }
+    return total;
+  }
+
+private:
+  /**
+   * @brief Free block header, written over the recycled memory.
+   */
+  struct FreeBlock {
+    FreeBlock *next;                     // Next block in the same batch
+    std::atomic<FreeBlock *> next_batch; // Next batch on the global stack
+    std::size_t count;                   // Blocks in the batch (head only)
+  };
+
+  /**
+   * @brief Per-thread free lists and counters.
+   */
+  struct ThreadCache {
+    struct List {
+      FreeBlock *head = nullptr; // Most recently freed block
+      std::size_t count = 0;     // Number of blocks in the list
+    };
+
+    List lists[kSizeClasses];
+    std::size_t limit;
+    // Written only by the owning thread; atomic so that stats() can read them.
+    std::atomic<std::size_t> hits{0};
+    std::atomic<std::size_t> misses{0};
+    std::atomic<std::size_t> refills{0};
+    std::atomic<std::size_t> drained{0};
+    ThreadCache *next_registered = nullptr;
+
+    ThreadCache() : limit(default_limit.load(std::memory_order_relaxed)) {
+      std::lock_guard<std::mutex> lock(registry_mutex());
+      next_registered = registry_head();
+      registry_head() = this;
+    }
+
+    ~ThreadCache() {
+      for (std::size_t i = 0; i < kSizeClasses; ++i) {
+        if (lists[i].count) {
+          drain(this, lists[i], i, lists[i].count);
+        }
+      }
+      thread_cache_destroyed() = true;
+
+      std::lock_guard<std::mutex> lock(registry_mutex());
+      auto link = &registry_head();
+      while (*link != this) {
+        link = &(*link)->next_registered;
+      }
+      *link = next_registered;
+      auto &retired = retired_stats();
+      retired.hits += hits.load(std::memory_order_relaxed);
+      retired.misses += misses.load(std::memory_order_relaxed);
+      retired.refills += refills.load(std::memory_order_relaxed);
+      retired.drained += drained.load(std::memory_order_relaxed);
+    }
+  };
+
+  static_assert(sizeof(FreeBlock) <= kGranularity,
+                "free block header must fit in the smallest size class");
+
+  static constexpr int kTagShift = 48;
+  static constexpr std::uint64_t kPointerMask =
+      (std::uint64_t(1) << kTagShift) - 1;
+
+  // Global stacks of batches, one per size class. The upper 16 bits of each
+  // head hold a tag bumped on every update, guarding against ABA.
+  static inline std::atomic<std::uint64_t> global_heads[kSizeClasses] = {};
+  static inline std::atomic<std::size_t> default_limit{
+      kDefaultThreadCacheLimit};
+
+  static std::size_t size_class_of(std::size_t size) {
+    return size == 0 ? 0 : (size - 1) / kGranularity;
+  }
+
+  static void bump(std::atomic<std::size_t> &counter, std::size_t count = 1) {
+    counter.store(counter.load(std::memory_order_relaxed) + count,
+                  std::memory_order_relaxed);
+  }
+
+  static std::mutex &registry_mutex() {
+    static std::mutex mutex;
+    return mutex;
+  }
+
+  static ThreadCache *&registry_head() {
+    static ThreadCache *head = nullptr;
+    return head;
+  }
+
+  static Stats &retired_stats() {
+    static Stats stats = {};
+    return stats;
+  }
+
+  static bool &thread_cache_destroyed() {
+    thread_local bool destroyed = false;
+    return destroyed;
+  }
+
+  /**
+   * @brief Get the calling thread's cache, or nullptr once it is torn down.
+   */
+  static ThreadCache *thread_cache() {
+    if (thread_cache_destroyed()) {
+      return nullptr;
+    }
+    thread_local ThreadCache cache;
+    return &cache;
+  }
+
+  /**
+   * @brief Refill from the global stack, or fall back to operator new.
+   */
+  static void *allocate_slow(std::size_t size_class, ThreadCache *cache) {
+    if (auto batch = pop_batch(size_class)) {
+      if (cache) {
+        bump(cache->refills);
+        bump(cache->hits);
+        cache->lists[size_class].head = batch->next;
+        cache->lists[size_class].count = batch->count - 1;
+      } else if (batch->next) {
+        batch->next->count = batch->count - 1;
+        push_batch(size_class, batch->next, batch->count - 1);
+      }
+      return batch;
+    }
+    if (cache) {
+      bump(cache->misses);
+    }
+    return ::operator new((size_class + 1) * kGranularity,
+                          std::align_val_t(kGranularity));
+  }
+
+  /**
+   * @brief Move the `count` most recently freed blocks of a list to the
+   * global stack.
+   */
+  static void drain(ThreadCache *cache, typename ThreadCache::List &list,
+                    std::size_t size_class, std::size_t count) {
+    auto first = list.head;
+    auto last = first;
+    for (std::size_t i = 1; i < count; ++i) {
+      last = last->next;
+    }
+    list.head = last->next;
+    list.count -= count;
+    last->next = nullptr;
+    push_batch(size_class, first, count);
+    bump(cache->drained, count);
+  }
+
+  static void push_batch(std::size_t size_class, FreeBlock *first,
+                         std::size_t count) {
+    first->count = count;
+    auto &head = global_heads[size_class];
+    auto old = head.load(std::memory_order_relaxed);
+    std::uint64_t desired;
+    do {
+      first->next_batch.store(reinterpret_cast<FreeBlock *>(old & kPointerMask),
+                              std::memory_order_relaxed);
+      desired = ((old >> kTagShift) + 1) << kTagShift |
+                reinterpret_cast<std::uint64_t>(first);
+    } while (!head.compare_exchange_weak(old, desired,
+                                         std::memory_order_release,
+                                         std::memory_order_relaxed));
+  }
+
+  static FreeBlock *pop_batch(std::size_t size_class) {
+    auto &head = global_heads[size_class];
+    auto old = head.load(std::memory_order_acquire);
+    while (auto first = reinterpret_cast<FreeBlock *>(old & kPointerMask)) {
+      auto next = first->next_batch.load(std::memory_order_relaxed);
+      auto desired = ((old >> kTagShift) + 1) << kTagShift |
+                     reinterpret_cast<std::uint64_t>(next);
+      if (head.compare_exchange_weak(old, desired, std::memory_order_acquire,
+                                     std::memory_order_acquire)) {
+        return first;
+      }
+    }
+    return nullptr;
+  }
+};
+
+/**
+ * @brief ArcPoolAllocator class
+ *
+ * A std-style allocator drawing from `ArcPool`, for use with `allocate_arc`.
+ *
+ * @tparam T The type of the objects being allocated.
+ */
+template <typename T> struct ArcPoolAllocator {
+  using value_type = T;
+
+  ArcPoolAllocator() = default;
+  template <typename U> ArcPoolAllocator(const ArcPoolAllocator<U> &) {}
+
+  T *allocate(std::size_t n) {
+    static_assert(alignof(T) <= ArcPool::kGranularity,
+                  "ArcPool blocks are aligned to a cache line");
+    return static_cast<T *>(ArcPool::allocate(n * sizeof(T)));
+  }
+
+  void deallocate(T *ptr, std::size_t n) {
+    ArcPool::deallocate(ptr, n * sizeof(T));
+  }
+
+  template <typename U> bool operator==(const ArcPoolAllocator<U> &) const {
+    return true;
+  }
+
+  template <typename U> bool operator!=(const ArcPoolAllocator<U> &) const {
+    return false;
+  }
+};
+
+/**
+ * @brief ArcReclaimer class
+ *
+ * Background reclaimer for objects that are expensive to destroy, such as
+ * large graphs. Types opt in by specializing `ArcDeferredDestruction`. The
+ * final release of such an object then pushes its control block onto a
+ * lock-free queue instead of destroying it, and a background thread destroys
+ * the queued objects in batches, so the releasing thread only pays for the
+ * push.
+ *
+ * The thread starts on first use and is joined at exit, after it has
+ * destroyed everything still queued. Objects released after that point are
+ * destroyed inline.
+ */
+class ArcReclaimer {
+public:
+  /**
+   * @brief Queue link embedded in deferred control blocks.
+   */
+  struct Node {
+    Node *next_reclaim = nullptr;                   // Next queued block
+    void (*reclaim)(Node *node) noexcept = nullptr; // Destroys and frees
+  };
+
+  /**
+   * @brief Stand-in base for control blocks of types that are not deferred.
+   */
+  struct NoNode {};
+
+  /**
+   * @brief Hand a block to the reclaimer.
+   *
+   * Lock-free, except that the push that makes the queue non-empty briefly
+   * takes the worker's mutex to wake it up.
+   *
+   * @param node The block whose object is to be destroyed.
+   */
+  static void defer(Node *node) noexcept {
+    if (shut_down.load(std::memory_order_acquire)) {
+      node->reclaim(node);
+      return;
+    }
+    Worker *running;
+    try {
+      running = &worker();
+    } catch (...) {
+      node->reclaim(node); // No thread to defer to
+      return;
+    }
+    auto head = queue.load(std::memory_order_relaxed);
+    do {
+      node->next_reclaim = head;
+    } while (!queue.compare_exchange_weak(head, node,
+                                          std::memory_order_release,
+                                          std::memory_order_relaxed));
+    if (!head) {
+      running->wake();
+    }
+  }
+
+  /**
+   * @brief Destroy every block queued so far on the calling thread.
+   *
+   * The background thread runs this in a loop; calling it directly lets a
+   * program drain the queue at a point of its choosing, such as in tests or
+   * before a latency-insensitive phase.
+   *
+   * @return Number of objects destroyed.
+   */
+  static std::size_t reclaim() noexcept {
+    // Take the whole queue, then restore release order.
+    auto node = queue.exchange(nullptr, std::memory_order_acquire);
+    Node *ordered = nullptr;
+    while (node) {
+      auto next = node->next_reclaim;
+      node->next_reclaim = ordered;
+      ordered = node;
+      node = next;
+    }
+    std::size_t count = 0;
+    while (ordered) {
+      auto next = ordered->next_reclaim;
+      ordered->reclaim(ordered);
+      ordered = next;
+      ++count;
+    }
+    return count;
+  }
+
+private:
+  /**
+   * @brief The background thread and what it sleeps on.
+   */
+  class Worker {
+  private:
+    std::mutex mutex;
+    std::condition_variable wakeup;
+    bool stopping = false;
+    std::thread thread;
+
+    void run() {
+      for (;;) {
+        {
+          std::unique_lock<std::mutex> lock(mutex);
+          wakeup.wait(lock, [this] {
+            return stopping || queue.load(std::memory_order_relaxed);
+          });
+          if (stopping && !queue.load(std::memory_order_relaxed)) {
+            return;
+          }
+        }
+        reclaim();
+      }
+    }
+
+  public:
+    Worker() : thread([this] { run(); }) {}
+
+    ~Worker() {
+      shut_down.store(true, std::memory_order_release);
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+      }
+      wakeup.notify_one();
+      thread.join();
+      reclaim();
+    }
+
+    void wake() {
+      std::lock_guard<std::mutex> lock(mutex);
+      wakeup.notify_one();
+    }
+  };
+
+  static inline std::atomic<Node *> queue{nullptr}; // Blocks to destroy
+  static inline std::atomic<bool> shut_down{false}; // Worker has exited
+
+  static Worker &worker() {
+    static Worker instance;
+    return instance;
+  }
+};
+
+/**
+ * @brief ArcDropList class
+ *
+ * Iterative destruction for deeply linked structures, such as long lists or
+ * deep trees of Arcs. Types opt in by specializing `ArcIterativeDestruction`.
+ * Destroying such an object releases the Arcs it holds, and when one of them
+ * was the last reference to another opted-in object, that object is not
+ * destroyed there and then, recursively, but pushed onto a per-thread
+ * worklist. The outermost final release destroys the worklist in a loop, so
+ * stack use stays bounded however deep the structure is.
+ */
+class ArcDropList {
+public:
+  using Node = ArcReclaimer::Node;
+
+  /**
+   * @brief Destroy a block now, or after the one being destroyed.
+   *
+   * @param node The block whose last strong reference is gone.
+   */
+  static void drop(Node *node) noexcept {
+    auto &list = thread_list();
+    node->next_reclaim = list.head;
+    list.head = node;
+    if (list.draining) {
+      return; // Called from a destructor below the outermost drop
+    }
+    list.draining = true;
+    while (auto next = list.head) {
+      list.head = next->next_reclaim;
+      next->reclaim(next);
+    }
+    list.draining = false;
+  }
+
+private:
+  struct List {
+    Node *head = nullptr;  // Blocks waiting to be destroyed, newest first
+    bool draining = false; // A drop further up the stack is looping
+  };
+
+  static List &thread_list() {
+    thread_local List list;
+    return list;
+  }
+};
+
+/**
+ * @brief ArcEpoch class
+ *
+ * Epoch-based reclamation for objects that readers borrow without touching
+ * their reference count. Types opt in by specializing `ArcEpochDestruction`.
+ * The final release of such an object retires its control block instead of
+ * destroying it, and the block is only destroyed once every thread that was
+ * pinned at the time has unpinned.
+ *
+ * A reader pins the current epoch by creating an `EpochGuard`, usually
+ * through `AtomicArc::borrow`. Pinning writes to a per-thread record only, so
+ * read-mostly fan-out never writes to a shared cache line. The global epoch
+ * advances once every pinned thread has caught up with it. A block retired in
+ * epoch e is destroyed once the epoch reaches e + 2, by which point no
+ * reader that could have seen it is still pinned.
+ */
+class ArcEpoch {
+public:
+  /**
+   * @brief Retire-list link embedded in epoch-managed control blocks.
+   */
+  struct Node {
+    Node *next_retired = nullptr;                   // Next retired block
+    std::uint64_t retire_epoch = 0;                 // Epoch it was retired in
+    void (*reclaim)(Node *node) noexcept = nullptr; // Destroys and frees
+  };
+
+  /**
+   * @brief Retire a block whose last strong reference is gone.
+   *
+   * Every few retirements on a thread also run `collect()`.
+   *
+   * @param node The block whose object is to be destroyed.
+   */
+  static void retire(Node *node) noexcept {
+    if (shut_down.load(std::memory_order_acquire)) {
+      node->reclaim(node);
+      return;
+    }
+    sweeper(); // Make sure whatever is left gets destroyed at exit
+    node->retire_epoch = global_epoch.load(std::memory_order_seq_cst);
+    push(node, node);
+    thread_local unsigned retired = 0;
+    if (++retired % kCollectInterval == 0) {
+      collect();
+    }
+  }
+
+  /**
+   * @brief Try to advance the epoch and destroy the blocks that are safe to.
+   *
+   * Call this after retiring a burst of objects to release them promptly.
+   *
+   * @return Number of objects destroyed.
+   */
+  static std::size_t collect() noexcept {
+    try_advance();
+    auto epoch = global_epoch.load(std::memory_order_acquire);
+    auto node = retired.exchange(nullptr, std::memory_order_acquire);
+    Node *kept = nullptr;
+    Node *kept_last = nullptr;
+    std::size_t count = 0;
+    while (node) {
+      auto next = node->next_retired;
+      if (node->retire_epoch + 2 <= epoch) {
+        node->reclaim(node);
+        ++count;
+      } else {
+        node->next_retired = kept;
+        kept = node;
+        kept_last = kept_last ? kept_last : node;
+      }
+      node = next;
+    }
+    if (kept) {
+      push(kept, kept_last);
+    }
+    return count;
+  }
+
+private:
+  friend class EpochPin;
+
+  /**
+   * @brief A thread's pinned epoch, on its own cache line.
+   *
+   * Records are never freed; a thread that exits hands its record to the
+   * next thread that needs one.
+   */
+  struct alignas(kArcCacheLine) Record {
+    std::atomic<std::uint64_t> pinned{0}; // Pinned epoch, or zero
+    std::atomic<bool> in_use{true};       // Owned by a live thread
+    Record *next = nullptr;               // Next record in the registry
+    unsigned depth = 0;                   // Nested pins, owner only
+  };
+
+  /**
+   * @brief Thread-local handle on the calling thread's record.
+   */
+  struct ThreadRecord {
+    Record *record = acquire_record();
+
+    ~ThreadRecord() {
+      record->depth = 0;
+      record->pinned.store(0, std::memory_order_release);
+      record->in_use.store(false, std::memory_order_release);
+    }
+  };
+
+  /**
+   * @brief Destroys every retired block at exit, when no thread is reading.
+   */
+  struct Sweeper {
+    ~Sweeper() {
+      shut_down.store(true, std::memory_order_release);
+      auto node = retired.exchange(nullptr, std::memory_order_acquire);
+      while (node) {
+        auto next = node->next_retired;
+        node->reclaim(node);
+        node = next;
+      }
+    }
+  };
+
+  static constexpr unsigned kCollectInterval = 64;
+
+  static inline std::atomic<std::uint64_t> global_epoch{1}; // Current epoch
+  static inline std::atomic<Record *> records{nullptr};     // Registry
+  static inline std::atomic<Node *> retired{nullptr};       // Retired blocks
+  static inline std::atomic<bool> shut_down{false};         // Swept at exit
+
+  static Sweeper &sweeper() {
+    static Sweeper instance;
+    return instance;
+  }
+
+  static Record &thread_record() {
+    thread_local ThreadRecord handle;
+    return *handle.record;
+  }
+
+  static Record *acquire_record() {
+    for (auto record = records.load(std::memory_order_acquire); record;
+         record = record->next) {
+      auto free = false;
+      if (!record->in_use.load(std::memory_order_relaxed) &&
+          record->in_use.compare_exchange_strong(free, true,
+                                                 std::memory_order_acquire)) {
+        return record;
+      }
+    }
+    auto record = new Record;
+    record->next = records.load(std::memory_order_relaxed);
+    while (!records.compare_exchange_weak(record->next, record,
+                                          std::memory_order_release,
+                                          std::memory_order_relaxed)) {
+    }
+    return record;
+  }
+
+  /**
+   * @brief Push a linked list of blocks onto the retire list.
+   */
+  static void push(Node *first, Node *last) {
+    last->next_retired = retired.load(std::memory_order_relaxed);
+    while (!retired.compare_exchange_weak(last->next_retired, first,
+                                          std::memory_order_release,
+                                          std::memory_order_relaxed)) {
+    }
+  }
+
+  // ThreadSanitizer does not model standalone fences, and GCC warns about
+  // them under it. As in `arc_acquire_fence`, the fences of `pin` and
+  // `try_advance` then become seq_cst operations on the atomics they order.
+#ifdef ARC_TSAN
+  static constexpr auto kPinnedLoad = std::memory_order_seq_cst;
+#else
+  static constexpr auto kPinnedLoad = std::memory_order_relaxed;
+#endif
+
+  /**
+   * @brief Advance the global epoch if every pinned thread has reached it.
+   */
+  static void try_advance() {
+#ifdef ARC_TSAN
+    auto epoch = global_epoch.load(std::memory_order_seq_cst);
+#else
+    auto epoch = global_epoch.load(std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+#endif
+    for (auto record = records.load(std::memory_order_acquire); record;
+         record = record->next) {
+      auto pinned = record->pinned.load(kPinnedLoad);
+      if (pinned != 0 && pinned != epoch) {
+        return;
+      }
+    }
+#ifndef ARC_TSAN
+    std::atomic_thread_fence(std::memory_order_acquire);
+#endif
+    global_epoch.compare_exchange_strong(epoch, epoch + 1,
+                                         std::memory_order_acq_rel,
+                                         std::memory_order_relaxed);
+  }
+
+  static void pin() {
+    auto &record = thread_record();
+    if (record.depth++ == 0) {
+      auto epoch = global_epoch.load(std::memory_order_relaxed);
+#ifdef ARC_TSAN
+      record.pinned.exchange(epoch, std::memory_order_seq_cst);
+#else
+      record.pinned.store(epoch, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+#endif
+    }
+  }
+
+  static void unpin() {
+    auto &record = thread_record();
+    if (--record.depth == 0) {
+      record.pinned.store(0, std::memory_order_release);
+    }
+  }
+};
+
+/**
+ * @brief EpochPin class
+ *
+ * RAII pin on the current `ArcEpoch` epoch. While it is alive, no
+ * epoch-managed object the thread can still see is destroyed. Pins nest, and
+ * must stay on the thread that created them.
+ */
+class EpochPin {
+private:
+  bool pinned; // False once moved from
+
+public:
+  EpochPin() : pinned(true) { ArcEpoch::pin(); }
+
+  EpochPin(EpochPin &&other) noexcept : pinned(other.pinned) {
+    other.pinned = false;
+  }
+
+  EpochPin(const EpochPin &) = delete;
+  EpochPin &operator=(const EpochPin &) = delete;
+  EpochPin &operator=(EpochPin &&) = delete;
+
+  ~EpochPin() {
+    if (pinned) {
+      ArcEpoch::unpin();
+    }
+  }
+};
+
+/**
+ * @brief Opt a type into deferred destruction through `ArcReclaimer`.
+ *
+ * Specialize as `std::true_type` for types whose destruction should not run
+ * on the thread that drops the last reference:
+ *
+ *     template <> struct ArcDeferredDestruction<Graph> : std::true_type {};
+ *
+ * The specialization must be visible wherever `Arc<Graph>` blocks are
+ * created.
+ *
+ * @tparam T The type of the object being managed.
+ */
+template <typename T> struct ArcDeferredDestruction : std::false_type {};
+
+/**
+ * @brief Opt a type into epoch-based destruction through `ArcEpoch`.
+ *
+ * Specialize as `std::true_type` for types that readers borrow with
+ * `AtomicArc::borrow`:
+ *
+ *     template <> struct ArcEpochDestruction<Config> : std::true_type {};
+ *
+ * The specialization must be visible wherever `Arc<Config>` blocks are
+ * created. A type cannot use both this and `ArcDeferredDestruction`.
+ *
+ * @tparam T The type of the object being managed.
+ */
+template <typename T> struct ArcEpochDestruction : std::false_type {};
+
+/**
+ * @brief Opt a type into iterative destruction through `ArcDropList`.
+ *
+ * Specialize as `std::true_type` for the nodes of deep structures, whose
+ * destructors would otherwise release each other recursively:
+ *
+ *     template <> struct ArcIterativeDestruction<ListNode> : std::true_type {};
+ *
+ * The specialization must be visible wherever `Arc<ListNode>` blocks are
+ * created. A type uses at most one of this, `ArcDeferredDestruction` and
+ * `ArcEpochDestruction`.
+ *
+ * @tparam T The type of the object being managed.
+ */
+template <typename T> struct ArcIterativeDestruction : std::false_type {};
+
+/**
+ * @brief Opt a type into the padded control block layout.
+ *
+ * The blocks `make_arc` and `allocate_arc` create are compact by default:
+ * the counts and the object take as few bytes as they can, which keeps bulk
+ * small objects dense, but neighbouring blocks may share a cache line, and
+ * every count update on one then evicts the others from readers' caches.
+ * Specialize as `std::true_type` for hot objects shared between threads:
+ *
+ *     template <> struct ArcPaddedLayout<Schema> : std::true_type {};
+ *
+ * Their blocks then start on a cache line of their own and the object on
+ * the next one, so count updates disturb neither the neighbours nor the
+ * object's fields, for up to two cache lines per block. Like the traits
+ * above, it is read where blocks are created.
+ *
+ * @tparam T The type of the object being managed.
+ */
+template <typename T> struct ArcPaddedLayout : std::false_type {};
+
+/**
+ * @brief Alignment of a T stored inline in a control block: at least a
+ * cache line for padded types, its natural alignment otherwise. The block
+ * inherits it, so a padded block starts on a cache line as well.
+ */
+template <typename T>
+inline constexpr std::size_t kArcBlockAlignment =
+    ArcPaddedLayout<T>::value && alignof(T) < kArcCacheLine ? kArcCacheLine
+                                                            : alignof(T);
+
+/**
+ * @brief Link a control block of T embeds to be handed over for destruction.
+ *
+ * Only named inside the control block, so that the traits above are read
+ * once T is complete and its specializations are visible.
+ */
+template <typename T>
+using ArcReclaimNode = std::conditional_t<
+    ArcEpochDestruction<T>::value, ArcEpoch::Node,
+    std::conditional_t<ArcDeferredDestruction<T>::value ||
+                           ArcIterativeDestruction<T>::value,
+                       ArcReclaimer::Node, ArcReclaimer::NoNode>>;
+
+/**
+ * @brief Type-erased part of every Arc control block.
+ *
+ * Inherits the strong and weak counts from the counting policy, and knows how
+ * to destroy the object and free itself without depending on the object type.
+ * Counting policies that finish a release outside of `Arc` itself (such as
+ * `BiasedCount`) reach the block through this class.
+ *
+ * @tparam Count Counting policy providing the reference counts.
+ */
+template <typename Count> struct ArcControlBlockBase : Count {
+  ArcControlBlockBase() = default;
+
+  constexpr explicit ArcControlBlockBase(ArcImmortalTag tag) : Count(tag) {}
+
+  virtual ~ArcControlBlockBase() = default;
+
+  /**
+   * @brief Destroy the managed object, leaving the block itself alive.
+   */
+  virtual void destroy() noexcept = 0;
+
+  /**
+   * @brief Free the block, returning its memory to where it came from.
+   */
+  virtual void deallocate() noexcept { delete this; }
+
+  /**
+   * @brief Drop strong references and destroy the object if they were the
+   * last.
+   *
+   * @param count Number of strong references to drop.
+   */
+  void release(int count = 1) {
+    if (this->decrement(count)) {
+      dispose();
+    }
+  }
+
+  /**
+   * @brief Finish the release once the last strong reference is gone.
+   *
+   * Destroys the object and drops the weak reference the strong ones held.
+   * Blocks of types with deferred destruction hand themselves to
+   * `ArcReclaimer` instead.
+   */
+  virtual void dispose() noexcept {
+    destroy();
+    release_weak();
+  }
+
+  /**
+   * @brief Drop one weak reference and free the block if it was the last.
+   */
+  void release_weak() {
+    if (this->decrement_weak()) {
+      deallocate();
+    }
+  }
+};
+
+inline void BiasedCount::drain(BiasedCount *block) {
+  while (block) {
+    auto next = block->next_queued;
+    auto base = static_cast<ArcControlBlockBase<BiasedCount> *>(block);
+    if (!block->merged) {
+      block->merged = true;
+      if (block->merge()) {
+        base->dispose();
+      }
+    }
+    base->release_weak(); // The queue's own weak reference
+    block = next;
+  }
+}
+
+inline void BiasedCount::unpin() {
+  static_cast<ArcControlBlockBase<BiasedCount> *>(this)->release_weak();
+}
+
+/**
+ * @brief ArcStats class
+ *
+ * Opt-in reference count instrumentation. Define `ARC_STATS` before including
+ * this header and every Arc type tallies, per element type and per thread,
+ * the objects constructed and destroyed, clones, releases and weak upgrades.
+ * One count update in `kSampleInterval` on each thread is also timed, in
+ * cycles where the CPU has a time stamp counter and in nanoseconds
+ * otherwise, to show which types contend on their counts. `snapshot()` and
+ * `dump()` sum the tallies on demand, including those of exited threads.
+ *
+ * Without `ARC_STATS` the hooks are empty inline functions, so Arcs compile
+ * to the same code as without them and nothing here is instantiated.
+ */
+class ArcStats {
+public:
+#ifdef ARC_STATS
+  static constexpr bool kEnabled = true;
+#else
+  static constexpr bool kEnabled = false;
+#endif
+  static constexpr unsigned kSampleInterval = 64;     // Updates per timed one
+  static constexpr std::uint64_t kContendedTicks = 256; // Slower is contended
+  static constexpr std::size_t kMaxTypes = 256; // Later types share the last
+
+  /**
+   * @brief Events tallied per type.
+   */
+  enum Event {
+    kConstructed,   // Objects placed under an Arc
+    kDestroyed,     // Objects destroyed by their last release
+    kCloned,        // Strong references added to existing objects
+    kReleased,      // Strong references dropped
+    kUpgraded,      // Successful weak upgrades
+    kUpgradeFailed, // Weak upgrades of destroyed objects
+    kSampled,       // Timed count updates
+    kSampledTicks,  // Ticks spent in timed count updates
+    kContended,     // Timed updates slower than kContendedTicks
+    kEvents
+  };
+
+  /**
+   * @brief Tallies of one type, summed over all threads.
+   */
+  struct TypeStats {
+    std::string name;            // Element type of the Arcs
+    std::size_t counts[kEvents]; // Tally per Event
+
+    std::size_t live() const { // Objects not destroyed yet
+      return counts[kConstructed] - counts[kDestroyed];
+    }
+  };
+
+  enum class Format { kText, kJson };
+
+  /**
+   * @brief Add to the calling thread's tally of an event for a type.
+   *
+   * @tparam T The element type of the Arc recording the event.
+   * @param event The event.
+   * @param count Number of events.
+   */
+  template <typename T>
+  static void record(Event event, std::size_t count = 1) noexcept {
+    if constexpr (kEnabled) {
+      auto index = type_index<std::remove_cv_t<T>>();
+      auto table = thread_table();
+      if (!table) {
+        std::lock_guard<std::mutex> lock(registry_mutex());
+        retired()[index][event] += count;
+        return;
+      }
+      auto slot = table->slots[index].load(std::memory_order_relaxed);
+      if (!slot) {
+        slot = new (std::nothrow) Slot();
+        if (!slot) {
+          return; // Statistics never make an Arc operation fail
+        }
+        table->slots[index].store(slot, std::memory_order_release);
+      }
+      auto &counter = slot->counts[event];
+      counter.store(counter.load(std::memory_order_relaxed) + count,
+                    std::memory_order_relaxed);
+    } else {
+      static_cast<void>(event);
+      static_cast<void>(count);
+    }
+  }
+
+  /**
+   * @brief Perform a count update, timing it if it is this thread's turn.
+   *
+   * @tparam T The element type of the Arc updating its count.
+   * @param update The update, called once.
+   * @return What the update returns.
+   */
+  template <typename T, typename Update>
+  static decltype(auto) timed(Update &&update) {
+    if constexpr (kEnabled) {
+      if (++sample_tick() % kSampleInterval == 0) {
+        struct Timer {
+          std::uint64_t start = ticks();
+          ~Timer() {
+            auto elapsed = ticks() - start;
+            record<T>(kSampled);
+            record<T>(kSampledTicks, elapsed);
+            if (elapsed > kContendedTicks) {
+              record<T>(kContended);
+            }
+          }
+        } timer;
+        return update();
+      }
+    }
+    return update();
+  }
+
+  /**
+   * @brief Sum the tallies of all threads, exited ones included.
+   *
+   * @return One entry per type that recorded an event, in the order the
+   * types first did; empty without `ARC_STATS`.
+   */
+  static std::vector<TypeStats> snapshot() {
+    std::vector<TypeStats> result;
+    if constexpr (kEnabled) {
+      std::lock_guard<std::mutex> lock(registry_mutex());
+      auto &names = type_names();
+      for (std::size_t index = 0; index < names.size(); ++index) {
+        TypeStats stats{names[index], {}};
+        for (int event = 0; event < kEvents; ++event) {
+          stats.counts[event] = retired()[index][event];
+        }
+        for (auto table = registry_head(); table;
+             table = table->next_registered) {
+          if (auto slot = table->slots[index].load(std::memory_order_acquire)) {
+            for (int event = 0; event < kEvents; ++event) {
+              stats.counts[event] +=
+                  slot->counts[event].load(std::memory_order_relaxed);
+            }
+          }
+        }
+        result.push_back(std::move(stats));
+      }
+    }
+    return result;
+  }
+
+  /**
+   * @brief Write the current tallies, one type per line or as JSON.
+   *
+   * @param out The stream to write to.
+   * @param format Plain text table or a JSON array of objects.
+   */
+  static void dump(std::ostream &out = std::cerr,
+                   Format format = Format::kText) {
+    static constexpr const char *kNames[kEvents] = {
+        "constructed", "destroyed", "cloned",       "released", "upgraded",
+        "upgrade_failed", "sampled", "sampled_ticks", "contended"};
+    auto stats = snapshot();
+    if (format == Format::kJson) {
+      out << '[';
+      for (std::size_t i = 0; i < stats.size(); ++i) {
+        out << (i ? ",\n " : "") << "{\"type\": \"";
+        for (auto c : stats[i].name) {
+          if (c == '"' || c == '\\') {
+            out << '\\';
+          }
+          out << c;
+        }
+        out << '"';
+        for (int event = 0; event < kEvents; ++event) {
+          out << ", \"" << kNames[event] << "\": " << stats[i].counts[event];
+        }
+        out << ", \"live\": " << stats[i].live() << '}';
+      }
+      out << "]\n";
+      return;
+    }
+    for (auto &type : stats) {
+      out << type.name << ":";
+      for (int event = 0; event < kEvents; ++event) {
+        out << ' ' << kNames[event] << '=' << type.counts[event];
+      }
+      out << " live=" << type.live() << '\n';
+    }
+  }
+
+private:
+  /**
+   * @brief The calling thread's tallies of one type.
+   */
+  struct Slot {
+    // Written only by the owning thread; atomic so that snapshot() can read
+    // them.
+    std::atomic<std::size_t> counts[kEvents] = {};
+  };
+
+  /**
+   * @brief The calling thread's tallies, one lazily allocated slot per type.
+   */
+  struct ThreadTable {
+    std::atomic<Slot *> slots[kMaxTypes] = {};
+    ThreadTable *next_registered = nullptr;
+
+    ThreadTable() {
+      std::lock_guard<std::mutex> lock(registry_mutex());
+      next_registered = registry_head();
+      registry_head() = this;
+    }
+
+    ~ThreadTable() {
+      thread_table_destroyed() = true;
+
+      std::lock_guard<std::mutex> lock(registry_mutex());
+      auto link = &registry_head();
+      while (*link != this) {
+        link = &(*link)->next_registered;
+      }
+      *link = next_registered;
+      for (std::size_t index = 0; index < kMaxTypes; ++index) {
+        if (auto slot = slots[index].load(std::memory_order_relaxed)) {
+          for (int event = 0; event < kEvents; ++event) {
+            retired()[index][event] +=
+                slot->counts[event].load(std::memory_order_relaxed);
+          }
+          delete slot;
+        }
+      }
+    }
+  };
+
+  static std::mutex &registry_mutex() {
+    static std::mutex mutex;
+    return mutex;
+  }
+
+  static ThreadTable *&registry_head() {
+    static ThreadTable *head = nullptr;
+    return head;
+  }
+
+  static std::vector<std::string> &type_names() {
+    static std::vector<std::string> names;
+    return names;
+  }
+
+  static std::size_t (&retired())[kMaxTypes][kEvents] {
+    static std::size_t counts[kMaxTypes][kEvents] = {};
+    return counts;
+  }
+
+  static bool &thread_table_destroyed() {
+    thread_local bool destroyed = false;
+    return destroyed;
+  }
+
+  /**
+   * @brief Get the calling thread's table, or nullptr once it is torn down.
+   */
+  static ThreadTable *thread_table() {
+    if (thread_table_destroyed()) {
+      return nullptr;
+    }
+    thread_local ThreadTable table;
+    return &table;
+  }
+
+  static unsigned &sample_tick() {
+    thread_local unsigned tick = 0;
+    return tick;
+  }
+
+  static std::uint64_t ticks() {
+#if defined(ARC_STATS) && (defined(__x86_64__) || defined(__i386__))
+    return __rdtsc();
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+#endif
+  }
+
+  /**
+   * @brief Register a type under its readable name.
+   */
+  static std::size_t register_type(const char *mangled) {
+    std::string name = mangled;
+#if defined(ARC_STATS) && __has_include(<cxxabi.h>)
+    int status = 0;
+    if (auto demangled =
+            abi::__cxa_demangle(mangled, nullptr, nullptr, &status)) {
+      name = demangled;
+      std::free(demangled);
+    }
+#endif
+    std::lock_guard<std::mutex> lock(registry_mutex());
+    auto &names = type_names();
+    if (names.size() + 1 >= kMaxTypes) {
+      names.resize(kMaxTypes, "(other)");
+      return kMaxTypes - 1;
+    }
+    names.push_back(std::move(name));
+    return names.size() - 1;
+  }
+
+  template <typename T> static std::size_t type_index() {
+    static const std::size_t index = register_type(typeid(T).name());
+    return index;
+  }
+};
+
+// Forward declarations of Arc, WeakArc, AtomicArc and ImmortalArc classes
+template <typename T, typename Count = AtomicCount> class Arc;
+template <typename T, typename Count = AtomicCount> class WeakArc;
+template <typename T> class AtomicArc;
+template <typename T, typename Count = AtomicCount> class ImmortalArc;
+
+/**
+ * @brief Single-threaded counterparts of Arc and WeakArc.
+ *
+ * Same interface, with plain integer reference counts.
+ */
+template <typename T> using Rc = Arc<T, LocalCount>;
+template <typename T> using WeakRc = WeakArc<T, LocalCount>;
+
+/**
+ * @brief Arc class
+ *
+ * The Arc class provides shared ownership of an object. It uses reference
+ * counting to manage the object's lifetime. Multiple Arc instances can point to
+ * the same object, and the object is deleted when the last Arc instance goes
+ * out of scope.
+ *
+ * @tparam T The type of the object being managed.
+ * @tparam Count Counting policy for the control block (`AtomicCount` or
+ * `LocalCount`).
+ */
+template <typename T, typename Count> class Arc {
+private:
+  /**
+   * @brief Struct representing the control block for an Arc instance.
+   *
+   * The control block holds the strong and weak reference counts and a
+   * pointer to the data. Derived blocks decide where the data lives and how it
+   * is destroyed. Locking is left to the data itself; see `Mutex` and
+   * `RwLock`.
+   */
+  struct ArcControlBlock : ArcControlBlockBase<Count>, ArcReclaimNode<T> {
+    using ReclaimNode = ArcReclaimNode<T>;
+
+    static constexpr bool kEpoch = ArcEpochDestruction<T>::value;
+    static constexpr bool kDeferred = ArcDeferredDestruction<T>::value;
+    static constexpr bool kIterative = ArcIterativeDestruction<T>::value;
+
+    static_assert(kEpoch + kDeferred + kIterative <= 1,
+                  "A type uses one of epoch, deferred or iterative "
+                  "destruction");
+    // The reclaimer thread would destroy the object, and free the block,
+    // under the single-threaded counts.
+    static_assert(!(kDeferred && std::is_same_v<Count, LocalCount>),
+                  "Rc cannot hand objects to the reclaimer thread");
+    // Any thread's collect() may destroy a retired block.
+    static_assert(!(kEpoch && std::is_same_v<Count, LocalCount>),
+                  "Rc cannot retire objects to the epoch");
+
+    T *data; // Pointer to data
+
+    /**
+     * @brief Constructor to initialize the control block.
+     *
+     * @param ptr Pointer to the object being managed by Arc.
+     */
+    explicit ArcControlBlock(T *ptr) : data(ptr) {
+      if constexpr (kEpoch || kDeferred || kIterative) {
+        this->reclaim = [](ReclaimNode *node) noexcept {
+          auto block = static_cast<ArcControlBlock *>(node);
+          block->destroy();
+          block->release_weak();
+        };
+      }
+    }
+
+    /**
+     * @brief Constructor for a block that is never released.
+     *
+     * @param tag Selects saturated counts.
+     * @param ptr Pointer to the object being managed by Arc.
+     */
+    constexpr ArcControlBlock(ArcImmortalTag tag, T *ptr)
+        : ArcControlBlockBase<Count>(tag), data(ptr) {}
+
+    void dispose() noexcept override {
+      if constexpr (kEpoch) {
+        ArcEpoch::retire(this);
+      } else if constexpr (kDeferred) {
+        ArcReclaimer::defer(this);
+      } else if constexpr (kIterative) {
+        ArcDropList::drop(this);
+      } else {
+        ArcControlBlockBase<Count>::dispose();
+      }
+    }
+  };
+
+  /**
+   * @brief Control block adopting an object allocated by the caller.
+   */
+  struct PointerControlBlock final : ArcControlBlock {
+    explicit PointerControlBlock(T *ptr) : ArcControlBlock(ptr) {
+      ArcStats::record<T>(ArcStats::kConstructed);
+    }
+
+    void destroy() noexcept override {
+      // Arc<void> gets its objects by conversion and adopts only nullptr.
+      if constexpr (!std::is_void_v<T>) {
+        delete this->data;
+      }
+      ArcStats::record<T>(ArcStats::kDestroyed);
+    }
+  };
+
+  /**
+   * @brief Control block storing the object inline, right after the counts.
+   *
+   * Used by `make_arc` so that the counts and the object share a single
+   * allocation.
+   */
+  struct InlineControlBlock final : ArcControlBlock {
+    union {
+      alignas(kArcBlockAlignment<T>) T value; // Object constructed in place
+    };
+
+    /**
+     * @brief Constructor to build the object in place.
+     *
+     * @param args Arguments forwarded to the constructor of T.
+     */
+    template <typename... Args>
+    explicit InlineControlBlock(Args &&...args) : ArcControlBlock(nullptr) {
+      // Through a cv-free pointer, so that `const T` builds in place too.
+      ::new (const_cast<void *>(
+          static_cast<const volatile void *>(std::addressof(value))))
+          T(std::forward<Args>(args)...);
+      this->data = &value;
+      ArcStats::record<T>(ArcStats::kConstructed);
+    }
+
+    ~InlineControlBlock() override {}
+
+    void destroy() noexcept override {
+      value.~T();
+      ArcStats::record<T>(ArcStats::kDestroyed);
+    }
+
+#ifdef ARC_POOL
+    static void *operator new(std::size_t size) {
+      return ArcPool::allocate(size);
+    }
+
+    static void *operator new(std::size_t size, std::align_val_t alignment) {
+      if (static_cast<std::size_t>(alignment) > ArcPool::kGranularity) {
+        return ::operator new(size, alignment);
+      }
+      return ArcPool::allocate(size);
+    }
+
+    static void operator delete(void *ptr, std::size_t size) {
+      ArcPool::deallocate(ptr, size);
+    }
+
+    static void operator delete(void *ptr, std::size_t size,
+                                std::align_val_t alignment) {
+      if (static_cast<std::size_t>(alignment) > ArcPool::kGranularity) {
+        ::operator delete(ptr, size, alignment);
+        return;
+      }
+      ArcPool::deallocate(ptr, size);
+    }
+#endif
+  };
+
+  /**
+   * @brief Control block storing the object inline in memory obtained from an
+   * allocator.
+   *
+   * Used by `allocate_arc`. The block keeps a copy of the allocator so that
+   * the object is destroyed and the memory released through it.
+   *
+   * @tparam Alloc The allocator type supplied by the caller.
+   */
+  template <typename Alloc>
+  struct AllocatorControlBlock final : ArcControlBlock {
+    using BlockAllocator = typename std::allocator_traits<
+        Alloc>::template rebind_alloc<AllocatorControlBlock>;
+    // Rebound to the cv-free type, as std::allocate_shared does, since
+    // allocators of `const T` are not allowed.
+    using Value = std::remove_cv_t<T>;
+    using ValueAllocator =
+        typename std::allocator_traits<Alloc>::template rebind_alloc<Value>;
+
+    BlockAllocator allocator; // Allocator the block came from
+    union {
+      alignas(kArcBlockAlignment<T>) T value; // Object constructed in place
+    };
+
+    /**
+     * @brief Constructor to build the object in place.
+     *
+     * @param alloc The allocator to construct and later release through.
+     * @param args Arguments forwarded to the constructor of T.
+     */
+    template <typename... Args>
+    explicit AllocatorControlBlock(const Alloc &alloc, Args &&...args)
+        : ArcControlBlock(nullptr), allocator(alloc) {
+      ValueAllocator value_allocator(allocator);
+      std::allocator_traits<ValueAllocator>::construct(
+          value_allocator, const_cast<Value *>(std::addressof(value)),
+          std::forward<Args>(args)...);
+      this->data = &value;
+      ArcStats::record<T>(ArcStats::kConstructed);
+    }
+
+    ~AllocatorControlBlock() override {}
+
+    void destroy() noexcept override {
+      ValueAllocator value_allocator(allocator);
+      std::allocator_traits<ValueAllocator>::destroy(
+          value_allocator, const_cast<Value *>(std::addressof(value)));
+      ArcStats::record<T>(ArcStats::kDestroyed);
+    }
+
+    void deallocate() noexcept override {
+      BlockAllocator block_allocator(allocator);
+      this->~AllocatorControlBlock();
+      std::allocator_traits<BlockAllocator>::deallocate(block_allocator, this,
+                                                        1);
+    }
+  };
+
+  /**
+   * @brief Control block of an immortal object, storing it inline.
+   *
+   * Used by `ImmortalArc`. Arc instances refer to it through a tagged pointer
+   * and never update its counts, which start out saturated all the same. It
+   * is constant initialized whenever the object is.
+   */
+  struct ImmortalControlBlock final : ArcControlBlock {
+    union {
+      T value; // Object constructed in place, never destroyed
+    };
+
+    /**
+     * @brief Constructor to build the object in place.
+     *
+     * @param args Arguments forwarded to the constructor of T.
+     */
+    template <typename... Args>
+    constexpr explicit ImmortalControlBlock(Args &&...args)
+        : ArcControlBlock(ArcImmortalTag(), &value),
+          value(std::forward<Args>(args)...) {}
+
+    ~ImmortalControlBlock() override {}
+
+    void destroy() noexcept override {}
+
+    void deallocate() noexcept override {}
+  };
+
+  using BlockBase = ArcControlBlockBase<Count>;
+
+  /**
+   * @brief Control block standing in for a converted or aliasing Arc, whose
+   * pointer is not its block's own object.
+   *
+   * Used by `AtomicArc`, which finds the object through the block. Holds one
+   * strong reference to the real block.
+   */
+  struct AliasControlBlock final : ArcControlBlock {
+    BlockBase *owner; // Real block, tagged as in the Arc it came from
+
+    /**
+     * @brief Constructor to take over an Arc's reference.
+     *
+     * @param owner The real block, whose reference is transferred.
+     * @param ptr Pointer to the object the Arc points to.
+     */
+    AliasControlBlock(BlockBase *owner, T *ptr)
+        : ArcControlBlock(ptr), owner(owner) {}
+
+    void destroy() noexcept override {
+      if (auto block = counted(owner)) {
+        block->release();
+      }
+    }
+  };
+
+  // Friend declarations
+  template <typename U, typename C> friend class Arc;
+  friend class WeakArc<T, Count>;     // Allow access to WeakArc class
+  friend class AtomicArc<T>;          // Allow access to AtomicArc class
+  friend class ImmortalArc<T, Count>; // Allow access to ImmortalArc class
+
+  template <typename U, typename C, typename... Args>
+  friend Arc<U, C> make_arc(Args &&...args);
+
+  template <typename U, typename C, typename Alloc, typename... Args>
+  friend Arc<U, C> allocate_arc_with(const Alloc &alloc, Args &&...args);
+
+  template <typename It> friend void release_batch(It first, It last);
+
+  template <typename U, typename V, typename C>
+  friend Arc<U, C> dynamic_pointer_cast(const Arc<V, C> &arc) noexcept;
+
+  BlockBase *control_block; // Pointer to the control block, tagged
+  T *ptr;                   // Cached pointer to the managed object
+
+  // The block pointer is type-erased, so that Arcs of related types can share
+  // a block, and carries two tags. Immortal blocks are referenced with the
+  // low bit set, so copies and drops tell them apart without touching the
+  // block: they skip the count behind a branch on a register. The second bit
+  // marks converted and aliasing Arcs, whose pointer need not be the block's
+  // own object. Code that dereferences a block pointer strips the tags first.
+  static constexpr std::uintptr_t kImmortalTag = 1;
+  static constexpr std::uintptr_t kAliasTag = 2;
+  static constexpr std::uintptr_t kTagMask = kImmortalTag | kAliasTag;
+
+  static std::uintptr_t bits_of(BlockBase *block) {
+    return reinterpret_cast<std::uintptr_t>(block);
+  }
+
+  /**
+   * @brief Get the block whose counts an Arc instance updates.
+   *
+   * @param block Tagged block pointer.
+   * @return The untagged block, or nullptr for an empty Arc or an immortal
+   * object.
+   */
+  static BlockBase *counted(BlockBase *block) {
+    auto bits = bits_of(block);
+    if (bits & kImmortalTag) {
+      return nullptr;
+    }
+    return reinterpret_cast<BlockBase *>(bits & ~kAliasTag);
+  }
+
+  static BlockBase *tag(BlockBase *block, std::uintptr_t tags) {
+    return reinterpret_cast<BlockBase *>(bits_of(block) | tags);
+  }
+
+  static BlockBase *untag(BlockBase *block) {
+    return reinterpret_cast<BlockBase *>(bits_of(block) & ~kTagMask);
+  }
+
+  /**
+   * @brief Constructor to adopt an already referenced control block.
+   *
+   * The caller transfers one strong reference to the new Arc instance.
+   *
+   * @param block The control block, tagged, or nullptr for an empty Arc.
+   * @param ptr Pointer to the managed object.
+   */
+  Arc(BlockBase *block, T *ptr) : control_block(block), ptr(ptr) {}
+
+public:
+  /**
+   * @brief Constructor to create an Arc instance.
+   *
+   * Adopts an object allocated by the caller. Prefer `make_arc`, which places
+   * the object and the control block in a single allocation.
+   *
+   * @param ptr Pointer to the object being managed by Arc.
+   */
+  explicit Arc(T *ptr)
+      : control_block(new PointerControlBlock(ptr)), ptr(ptr) {}
+
+  /**
+   * @brief Copy constructor.
+   *
+   * Increments the reference count of the control block: a single relaxed
+   * atomic increment with the default policy, as for a `std::shared_ptr`
+   * copy. It takes no lock and never touches the object, whatever `Mutex`
+   * or `RwLock` it may contain.
+   *
+   * @param other The Arc instance to copy.
+   */
+  Arc(const Arc &other) noexcept
+      : control_block(other.control_block), ptr(other.ptr) {
+    if (auto block = counted(control_block)) {
+      add_reference(block);
+    }
+  }
+
+  /**
+   * @brief Converting constructor, from an Arc of a type whose pointer
+   * converts to `T *`, such as a derived class.
+   *
+   * Shares the other Arc's control block, with one reference count
+   * increment and no allocation.
+   *
+   * @param other The Arc instance to share with.
+   */
+  template <typename U, typename = std::enable_if_t<
+                            !std::is_same_v<U, T> &&
+                            std::is_convertible_v<U *, T *>>>
+  Arc(const Arc<U, Count> &other) noexcept : Arc(other, other.ptr) {}
+
+  /**
+   * @brief Converting move constructor.
+   *
+   * Takes over the other Arc's reference without touching the count. The
+   * other instance is left empty.
+   *
+   * @param other The Arc instance to move from.
+   */
+  template <typename U, typename = std::enable_if_t<
+                            !std::is_same_v<U, T> &&
+                            std::is_convertible_v<U *, T *>>>
+  Arc(Arc<U, Count> &&other) noexcept : Arc(std::move(other), other.ptr) {}
+
+  /**
+   * @brief Aliasing constructor.
+   *
+   * Shares ownership with `owner` while pointing to `ptr`, typically a member
+   * of the owner's object or an object it keeps alive, as with the aliasing
+   * constructor of `std::shared_ptr`. The block stays the owner's.
+   *
+   * @param owner The Arc instance to share ownership with.
+   * @param ptr Pointer to return from `get()`.
+   */
+  template <typename U>
+  Arc(const Arc<U, Count> &owner, T *ptr) noexcept
+      : control_block(tag(owner.control_block, kAliasTag)), ptr(ptr) {
+    if (auto block = counted(control_block)) {
+      add_reference(block);
+    }
+  }
+
+  /**
+   * @brief Aliasing move constructor.
+   *
+   * Takes over the owner's reference without touching the count. The owner is
+   * left empty.
+   *
+   * @param owner The Arc instance to move from.
+   * @param ptr Pointer to return from `get()`.
+   */
+  template <typename U>
+  Arc(Arc<U, Count> &&owner, T *ptr) noexcept
+      : control_block(tag(owner.control_block, kAliasTag)), ptr(ptr) {
+    owner.control_block = nullptr;
+    owner.ptr = nullptr;
+  }
+
+  /**
+   * @brief Move constructor.
+   *
+   * Takes over the control block of the other Arc instance without touching
+   * the reference count. The other instance is left empty.
+   *
+   * @param other The Arc instance to move from.
+   */
+  Arc(Arc &&other) noexcept
+      : control_block(other.control_block), ptr(other.ptr) {
+    other.control_block = nullptr;
+    other.ptr = nullptr;
+  }
+
+  /**
+   * @brief Assignment operator.
+   *
+   * Takes a reference on the other control block before the current one is
+   * released, so no lock is needed and assigning an Arc to itself is safe.
+   * The current block is released last, once this instance already holds
+   * the new one, so the old object may own `other`.
+   *
+   * @param other The Arc instance to assign.
+   * @return Reference to the assigned Arc instance.
+   */
+  Arc &operator=(const Arc &other) {
+    Arc copy(other);
+    std::swap(control_block, copy.control_block);
+    std::swap(ptr, copy.ptr);
+    return *this;
+  }
+
+  /**
+   * @brief Move assignment operator.
+   *
+   * Takes over the control block of the other Arc instance without touching
+   * its reference count, then releases the current one. The other instance
+   * is left empty. Because the release comes last, the old object may own
+   * `other`, as in the list walk `node = std::move(node->next)`.
+   *
+   * @param other The Arc instance to move from.
+   * @return Reference to the assigned Arc instance.
+   */
+  Arc &operator=(Arc &&other) noexcept {
+    if (this != &other) {
+      Arc moved(std::move(other));
+      std::swap(control_block, moved.control_block);
+      std::swap(ptr, moved.ptr);
+    }
+    return *this;
+  }
+
+  /**
+   * @brief Destructor.
+   *
+   * Decrements the reference count of the control block and releases the
+   * control block if the reference count reaches zero.
+   */
+  ~Arc() { release(); }
+
+  /**
+   * @brief Get the raw pointer to the managed object.
+   *
+   * @return Pointer to the managed object.
+   */
+  auto get() const { return ptr; }
+
+  /**
+   * @brief Size of the block `make_arc` allocates for a T, counts included.
+   *
+   * Depends on the counting policy and on `ArcPaddedLayout<T>`; see the
+   * overview after `make_arc`.
+   *
+   * @return Size of the block in bytes.
+   */
+  static constexpr std::size_t block_size() {
+    return sizeof(InlineControlBlock);
+  }
+
+  /**
+   * @brief Create a clone of the Arc object.
+   *
+   * Creates a new Arc object with the same control block, as the copy
+   * constructor does.
+   *
+   * @return Cloned Arc object.
+   */
+  Arc clone() const noexcept { return Arc(*this); }
+
+  /**
+   * @brief Constructor to share an object through a reference added
+   * beforehand.
+   *
+   * Takes over one of the strong references added by `retain` instead of
+   * adding one, so the count is not touched.
+   *
+   * @param other The Arc instance whose object to share.
+   * @param tag Selects adoption.
+   */
+  Arc(const Arc &other, ArcAdoptTag)
+      : control_block(other.control_block), ptr(other.ptr) {}
+
+  /**
+   * @brief Most references `retain` and `clone_n` add or drop in one update.
+   *
+   * Half the range of `int`, so a batch added below the overflow policies'
+   * limit cannot wrap the count past it.
+   */
+  static constexpr std::size_t kMaxBatch = std::numeric_limits<int>::max() / 2;
+
+  /**
+   * @brief Add strong references in a single atomic update, for Arc
+   * instances to be made later with the `ArcAdoptTag` constructor.
+   *
+   * Every reference added must be adopted exactly once, or it leaks.
+   * Counting policies take `int` updates, so a count above `kMaxBatch` is
+   * added `kMaxBatch` references at a time. Each update then stays within
+   * the range the overflow policies check.
+   *
+   * @param count Number of references to add.
+   */
+  void retain(std::size_t count) const {
+    if (auto block = counted(control_block)) {
+      for (; count > kMaxBatch; count -= kMaxBatch) {
+        add_reference(block, static_cast<int>(kMaxBatch));
+      }
+      if (count) {
+        add_reference(block, static_cast<int>(count));
+      }
+    }
+  }
+
+  /**
+   * @brief Write `count` clones of the Arc to an output iterator.
+   *
+   * Fan-out takes a single atomic update for all the clones instead of one
+   * each. If writing a clone throws, the references not handed out yet are
+   * dropped again.
+   *
+   * @param count Number of clones to make.
+   * @param out Output iterator receiving the clones.
+   * @return Output iterator past the last clone written.
+   */
+  template <typename OutputIt>
+  OutputIt clone_n(std::size_t count, OutputIt out) const {
+    retain(count);
+    auto remaining = count;
+    try {
+      while (remaining > 0) {
+        --remaining;
+        *out = Arc(*this, ArcAdoptTag());
+        ++out;
+      }
+    } catch (...) {
+      if (auto block = counted(control_block)) {
+        for (; remaining > kMaxBatch; remaining -= kMaxBatch) {
+          drop_references(block, static_cast<int>(kMaxBatch));
+        }
+        if (remaining) {
+          drop_references(block, static_cast<int>(remaining));
+        }
+      }
+      throw;
+    }
+    return out;
+  }
+
+  /**
+   * @brief Get mutable access to the object if this Arc is its only owner.
+   *
+   * Briefly locks the weak count while it reads the strong count, so a
+   * racing downgrade waits for it; `PackedAtomicCount` only needs one load.
+   *
+   * @return Reference to the object if there are no other strong or weak
+   * references, or an empty optional (also for an Arc holding no object).
+   */
+  template <typename U = T>
+  std::optional<std::reference_wrapper<U>> get_mut_if_unique() {
+    auto block = counted(control_block);
+    if (ptr && block && block->is_unique()) {
+      return std::ref(*ptr);
+    }
+    return std::nullopt;
+  }
+
+  /**
+   * @brief Get mutable access to the object, copying it first if it is
+   * shared.
+   *
+   * Copy-on-write, as Rust's `Arc::make_mut`: if this Arc is the only owner,
+   * the object is returned as is. Otherwise it is copied into a new block
+   * made by `make_arc`, which this Arc then points to; other Arcs keep the
+   * old object, and weak references stay with it. The Arc must hold an
+   * object.
+   *
+   * The copy is made as a `T`, whatever type the block was made for, so an
+   * Arc converted from `Arc<Derived>` would slice the object. Polymorphic
+   * types are rejected for that reason; for other converted Arcs, the copy
+   * holds only the `T` part.
+   *
+   * @return Reference to an object owned by this Arc alone.
+   */
+  template <typename U = T> U &make_mut() {
+    static_assert(!std::is_polymorphic_v<U>,
+                  "make_mut would copy only the static type of a polymorphic "
+                  "object");
+    auto block = counted(control_block);
+    if (!block || !block->is_unique()) {
+      auto copy = new InlineControlBlock(static_cast<const T &>(*ptr));
+      *this = Arc(copy, &copy->value);
+    }
+    return *ptr;
+  }
+
+private:
+  /**
+   * @brief Release the Arc's control block and delete it if necessary.
+   *
+   * Decrements the reference count of the control block and destroys the
+   * object if the reference count reaches zero. The block itself is freed
+   * once the last weak reference is gone as well.
+   */
+  void release() {
+    if (auto block = counted(control_block)) {
+      drop_references(block);
+    }
+  }
+
+  /**
+   * @brief Add strong references to a counted block.
+   *
+   * Every strong count increment of an Arc goes through here, so that
+   * `ARC_STATS` can tally and time it.
+   *
+   * @param block Untagged control block.
+   * @param count Number of references to add.
+   */
+  static void add_reference(BlockBase *block, int count = 1) noexcept {
+    ArcStats::record<T>(ArcStats::kCloned, count);
+    ArcStats::timed<T>([&] { block->increment(count); });
+  }
+
+  /**
+   * @brief Drop strong references to a counted block and finish the release
+   * if they were the last.
+   *
+   * The decrement alone is timed, not the destruction it may lead to.
+   *
+   * @param block Untagged control block.
+   * @param count Number of references to drop.
+   */
+  static void drop_references(BlockBase *block, int count = 1) {
+    ArcStats::record<T>(ArcStats::kReleased, count);
+    if (ArcStats::timed<T>([&] { return block->decrement(count); })) {
+      block->dispose();
+    }
+  }
+};
+
+/**
+ * @brief Create an Arc instance with the object stored in the control block.
+ *
+ * Constructs T in place right after the reference counts, so the object and
+ * its bookkeeping take one allocation and `get()` needs no extra indirection.
+ *
+ * @tparam T Type of the object.
+ * @tparam Count Counting policy of the result.
+ * @param args Arguments forwarded to the constructor of T.
+ * @return Arc instance managing the new object.
+ */
+template <typename T, typename Count = AtomicCount, typename... Args>
+Arc<T, Count> make_arc(Args &&...args) {
+  auto block = new typename Arc<T, Count>::InlineControlBlock(
+      std::forward<Args>(args)...);
+  return Arc<T, Count>(block, &block->value);
+}
+
+/**
+ * @brief Block sizes per counting policy and layout, for a word-sized
+ * object on 64-bit targets.
+ *
+ * Compact blocks hold the counts, the object pointer and the object back to
+ * back, and all fit one cache line (the size class they take with
+ * `ARC_POOL`); padded blocks take two. A policy change that alters them
+ * fails here first. The probes live in `detail`, out of users' way.
+ */
+namespace detail {
+struct ArcCompactProbe {
+  void *word;
+};
+struct ArcPaddedProbe {
+  void *word;
+};
+} // namespace detail
+template <>
+struct ArcPaddedLayout<detail::ArcPaddedProbe> : std::true_type {};
+
+#if UINTPTR_MAX == UINT64_MAX
+static_assert(
+    Arc<detail::ArcCompactProbe>::block_size() == 32 &&
+        Arc<detail::ArcCompactProbe, PackedAtomicCount<>>::block_size() ==
+            32 &&
+        Arc<detail::ArcCompactProbe, LocalCount>::block_size() == 32 &&
+        Arc<detail::ArcCompactProbe, BiasedCount>::block_size() == 64,
+    "Compact blocks are the counts, a pointer and the object");
+static_assert(
+    Arc<detail::ArcPaddedProbe>::block_size() == 2 * kArcCacheLine &&
+        Arc<detail::ArcPaddedProbe, PackedAtomicCount<>>::block_size() ==
+            2 * kArcCacheLine &&
+        Arc<detail::ArcPaddedProbe, LocalCount>::block_size() ==
+            2 * kArcCacheLine &&
+        Arc<detail::ArcPaddedProbe, BiasedCount>::block_size() ==
+            2 * kArcCacheLine,
+    "Padded blocks are a cache line of counts, then the object");
+#endif
+
+/**
+ * @brief Create an Arc instance in memory obtained from an allocator.
+ *
+ * Implementation of `allocate_arc` once the allocator has been normalized to
+ * a std-style allocator.
+ *
+ * @tparam T Type of the object.
+ * @tparam Count Counting policy of the result.
+ * @param alloc The allocator providing the memory for the block.
+ * @param args Arguments forwarded to the constructor of T.
+ * @return Arc instance managing the new object.
+ */
+template <typename T, typename Count, typename Alloc, typename... Args>
+Arc<T, Count> allocate_arc_with(const Alloc &alloc, Args &&...args) {
+  using Block = typename Arc<T, Count>::template AllocatorControlBlock<Alloc>;
+  using Traits = std::allocator_traits<typename Block::BlockAllocator>;
+
+  typename Block::BlockAllocator block_allocator(alloc);
+  auto memory = Traits::allocate(block_allocator, 1);
+  Block *block = nullptr;
+  try {
+    block = ::new (static_cast<void *>(std::addressof(*memory)))
+        Block(alloc, std::forward<Args>(args)...);
+  } catch (...) {
+    Traits::deallocate(block_allocator, memory, 1);
+    throw;
+  }
+  return Arc<T, Count>(block, &block->value);
+}
+
+/**
+ * @brief Create an Arc instance in memory obtained from a std-style
+ * allocator.
+ *
+ * Like `make_arc`, the counts and the object share one allocation. The block
+ * remembers the allocator, so the last release returns the memory to it.
+ *
+ * @tparam T Type of the object.
+ * @tparam Count Counting policy of the result.
+ * @param alloc The allocator providing the memory for the block.
+ * @param args Arguments forwarded to the constructor of T.
+ * @return Arc instance managing the new object.
+ */
+template <typename T, typename Count = AtomicCount, typename Alloc,
+          typename... Args,
+          typename = std::enable_if_t<
+              !std::is_convertible<Alloc, std::pmr::memory_resource *>::value>>
+Arc<T, Count> allocate_arc(const Alloc &alloc, Args &&...args) {
+  return allocate_arc_with<T, Count>(alloc, std::forward<Args>(args)...);
+}
+
+/**
+ * @brief Create an Arc instance in memory obtained from a memory resource.
+ *
+ * @tparam T Type of the object.
+ * @tparam Count Counting policy of the result.
+ * @param resource The memory resource providing the memory for the block.
+ * @param args Arguments forwarded to the constructor of T.
+ * @return Arc instance managing the new object.
+ */
+template <typename T, typename Count = AtomicCount, typename... Args>
+Arc<T, Count> allocate_arc(std::pmr::memory_resource *resource,
+                           Args &&...args) {
+  using Allocator = std::pmr::polymorphic_allocator<T>;
+  return allocate_arc_with<T, Count>(Allocator(resource),
+                                     std::forward<Args>(args)...);
+}
+
+/**
+ * @brief Create an Rc instance with the object stored in the control block.
+ *
+ * @tparam T Type of the object.
+ * @param args Arguments forwarded to the constructor of T.
+ * @return Rc instance managing the new object.
+ */
+template <typename T, typename... Args> Rc<T> make_rc(Args &&...args) {
+  return make_arc<T, LocalCount>(std::forward<Args>(args)...);
+}
+
+/**
+ * @brief Drop a batch of Arc instances with one atomic update per distinct
+ * control block.
+ *
+ * Sorts the range by control block, unless it is already grouped, and
+ * releases each group's references together. Every instance is left empty.
+ *
+ * @param first Random access iterator to the first Arc instance.
+ * @param last Iterator past the last Arc instance.
+ */
+template <typename It> void release_batch(It first, It last) {
+  using Handle = typename std::iterator_traits<It>::value_type;
+  auto by_block = [](const Handle &a, const Handle &b) {
+    return std::less<>()(Handle::counted(a.control_block),
+                         Handle::counted(b.control_block));
+  };
+  if (!std::is_sorted(first, last, by_block)) {
+    std::sort(first, last, by_block);
+  }
+  while (first != last) {
+    auto block = Handle::counted(first->control_block);
+    int count = 0;
+    for (; first != last && Handle::counted(first->control_block) == block;
+         ++first) {
+      first->control_block = nullptr;
+      first->ptr = nullptr;
+      ++count;
+    }
+    if (block) {
+      Handle::drop_references(block, count);
+    }
+  }
+}
+
+/**
+ * @brief Drop all the Arc instances in a vector, one atomic update per
+ * distinct control block, and clear it.
+ *
+ * @param handles The Arc instances to drop.
+ */
+template <typename T, typename Count>
+void release_batch(std::vector<Arc<T, Count>> &handles) {
+  release_batch(handles.begin(), handles.end());
+  handles.clear();
+}
+
+/**
+ * @brief Cast the pointer of an Arc with `static_cast`, as
+ * `std::static_pointer_cast` does.
+ *
+ * The result shares the control block, with one reference count increment
+ * and no allocation. Down from `Arc<void>` as well as down a class
+ * hierarchy.
+ *
+ * @tparam T Type to cast to.
+ * @param arc The Arc instance to cast.
+ * @return Arc instance sharing ownership with `arc`.
+ */
+template <typename T, typename U, typename Count>
+Arc<T, Count> static_pointer_cast(const Arc<U, Count> &arc) noexcept {
+  return Arc<T, Count>(arc, static_cast<T *>(arc.get()));
+}
+
+/**
+ * @brief Cast the pointer of an Arc with `static_cast`, taking over its
+ * reference without touching the count.
+ *
+ * @tparam T Type to cast to.
+ * @param arc The Arc instance to cast, left empty.
+ * @return Arc instance taking over the reference of `arc`.
+ */
+template <typename T, typename U, typename Count>
+Arc<T, Count> static_pointer_cast(Arc<U, Count> &&arc) noexcept {
+  auto ptr = static_cast<T *>(arc.get());
+  return Arc<T, Count>(std::move(arc), ptr);
+}
+
+/**
+ * @brief Cast the pointer of an Arc with `const_cast`, sharing its control
+ * block.
+ *
+ * @tparam T Type to cast to.
+ * @param arc The Arc instance to cast.
+ * @return Arc instance sharing ownership with `arc`.
+ */
+template <typename T, typename U, typename Count>
+Arc<T, Count> const_pointer_cast(const Arc<U, Count> &arc) noexcept {
+  return Arc<T, Count>(arc, const_cast<T *>(arc.get()));
+}
+
+/**
+ * @brief Cast the pointer of an Arc with `dynamic_cast`, sharing its control
+ * block if the cast succeeds.
+ *
+ * @tparam T Type to cast to.
+ * @param arc The Arc instance to cast.
+ * @return Arc instance sharing ownership with `arc`, or an empty Arc if the
+ * object is not a T.
+ */
+template <typename T, typename U, typename Count>
+Arc<T, Count> dynamic_pointer_cast(const Arc<U, Count> &arc) noexcept {
+  if (auto ptr = dynamic_cast<T *>(arc.get())) {
+    return Arc<T, Count>(arc, ptr);
+  }
+  return Arc<T, Count>(nullptr, nullptr);
+}
+
+/**
+ * @brief ImmortalArc class
+ *
+ * Storage for an object that lives as long as the program, such as an empty
+ * sentinel or a default configuration, handed out as ordinary Arc instances.
+ * The object sits in the ImmortalArc next to its control block, and the Arc
+ * instances refer to the block through a tagged pointer, much like CPython's
+ * immortal objects: copying and dropping them skips the reference count
+ * behind a predictable branch, and the block's cache line is never written.
+ * Weak references and AtomicArc work as usual. The object is never
+ * destroyed, not even at exit, so it may be used from other static
+ * destructors.
+ *
+ * The constructor is constexpr, so a static ImmortalArc of a type with a
+ * constexpr constructor is constant initialized and costs nothing at startup.
+ *
+ * @tparam T The type of the object.
+ * @tparam Count Counting policy of the Arc instances handed out. BiasedCount
+ * ties every block to the thread that made it and cannot be used.
+ */
+template <typename T, typename Count> class ImmortalArc {
+private:
+  static_assert(std::is_constructible_v<Count, ArcImmortalTag>,
+                "The counting policy has no immortal state");
+
+  using Block = typename Arc<T, Count>::ImmortalControlBlock;
+
+  mutable Block block; // Control block with the object inline
+
+public:
+  /**
+   * @brief Constructor to build the object in place.
+   *
+   * @param args Arguments forwarded to the constructor of T.
+   */
+  template <typename... Args>
+  constexpr explicit ImmortalArc(Args &&...args)
+      : block(std::forward<Args>(args)...) {}
+
+  ImmortalArc(const ImmortalArc &) = delete;
+  ImmortalArc &operator=(const ImmortalArc &) = delete;
+
+  /**
+   * @brief Get an Arc instance sharing the object.
+   *
+   * Neither allocates nor touches the reference count.
+   *
+   * @return Arc instance sharing the object.
+   */
+  Arc<T, Count> clone() const {
+    using Handle = Arc<T, Count>;
+    return Handle(Handle::tag(&block, Handle::kImmortalTag), &block.value);
+  }
+
+  /**
+   * @brief Get the raw pointer to the object.
+   *
+   * @return Raw pointer to the object.
+   */
+  T *get() const { return &block.value; }
+};
+
+/**
+ * @brief WeakArc class
+ *
+ * The WeakArc class provides weak references to an object managed by Arc.
+ * It allows observing the object without keeping it alive. WeakArc can be
+ * upgraded to an Arc if the object still exists.
+ *
+ * @tparam T The type of the object being managed.
+ * @tparam Count Counting policy shared with the corresponding Arc.
+ */
+template <typename T, typename Count> class WeakArc {
+private:
+  using Handle = Arc<T, Count>;
+  using BlockBase = ArcControlBlockBase<Count>;
+
+  BlockBase *control_block; // Shared control block, tagged as in the Arc
+  T *ptr;                   // Pointer the Arc had, for upgrades
+
+public:
+  /**
+   * @brief Constructor to create a WeakArc instance from an Arc instance.
+   *
+   * Increments the weak count of the Arc's control block; no allocation is
+   * made.
+   *
+   * @param arc The Arc instance.
+   */
+  explicit WeakArc(Arc<T, Count> &arc)
+      : control_block(arc.control_block), ptr(arc.ptr) {
+    if (auto block = Handle::counted(control_block)) {
+      block->increment_weak();
+    }
+  }
+
+  /**
+   * @brief Copy constructor.
+   *
+   * Increments the weak count of the control block.
+   *
+   * @param other The WeakArc instance to copy.
+   */
+  WeakArc(const WeakArc &other)
+      : control_block(other.control_block), ptr(other.ptr) {
+    if (auto block = Handle::counted(control_block)) {
+      block->increment_weak();
+    }
+  }
+
+  /**
+   * @brief Move constructor.
+   *
+   * Takes over the control block of the other WeakArc instance without
+   * touching the weak count. The other instance is left empty.
+   *
+   * @param other The WeakArc instance to move from.
+   */
+  WeakArc(WeakArc &&other) noexcept
+      : control_block(other.control_block), ptr(other.ptr) {
+    other.control_block = nullptr;
+    other.ptr = nullptr;
+  }
+
+  /**
+   * @brief Assignment operator.
+   *
+   * Increments the weak count of the other control block, then releases the
+   * current one once this instance already holds the new block.
+   *
+   * @param other The WeakArc instance to assign.
+   * @return Reference to the assigned WeakArc instance.
+   */
+  WeakArc &operator=(const WeakArc &other) {
+    if (this != &other) {
+      WeakArc copy(other);
+      std::swap(control_block, copy.control_block);
+      std::swap(ptr, copy.ptr);
+    }
+    return *this;
+  }
+
+  /**
+   * @brief Move assignment operator.
+   *
+   * Takes over the control block of the other WeakArc instance, then
+   * releases the current one. The other instance is left empty.
+   *
+   * @param other The WeakArc instance to move from.
+   * @return Reference to the assigned WeakArc instance.
+   */
+  WeakArc &operator=(WeakArc &&other) noexcept {
+    if (this != &other) {
+      WeakArc moved(std::move(other));
+      std::swap(control_block, moved.control_block);
+      std::swap(ptr, moved.ptr);
+    }
+    return *this;
+  }
+
+  /**
+   * @brief Destructor.
+   *
+   * Decrements the weak count of the control block and frees the block if
+   * neither strong nor weak references remain.
+   */
+  ~WeakArc() { release(); }
+
+  /**
+   * @brief Upgrade the WeakArc to a corresponding Arc instance.
+   *
+   * Attempts to upgrade the WeakArc to an Arc instance. If the object still
+   * exists, an Arc instance sharing the same control block is returned. If the
+   * object has been deleted, an empty Arc (whose `get()` is nullptr) is
+   * returned.
+   *
+   * @return Upgraded Arc instance or an empty Arc.
+   */
+  auto upgrade() const {
+    if (acquire()) {
+      return Handle(control_block, ptr);
+    }
+    return Handle(nullptr, nullptr);
+  }
+
+  /**
+   * @brief Upgrade the WeakArc if the object still exists.
+   *
+   * Like `upgrade`, but reports failure as an empty optional instead of an
+   * empty Arc. Neither path allocates: a hit adds one strong reference to the
+   * existing control block, with a single CAS unless another thread races on
+   * the count, and a miss only reads it.
+   *
+   * @return Arc sharing the control block, or std::nullopt if the object has
+   *         been deleted.
+   */
+  std::optional<Handle> try_upgrade() const {
+    if (acquire()) {
+      return std::optional<Handle>(Handle(control_block, ptr));
+    }
+    return std::nullopt;
+  }
+
+private:
+  /**
+   * @brief Add a strong reference for an upgrade.
+   *
+   * @return True if the object still exists and the caller now owns a strong
+   *         reference to it.
+   */
+  bool acquire() const {
+    if (auto block = Handle::counted(control_block)) {
+      if (block->try_increment()) {
+        ArcStats::record<T>(ArcStats::kUpgraded);
+        return true;
+      }
+      ArcStats::record<T>(ArcStats::kUpgradeFailed);
+    } else if (Handle::untag(control_block)) {
+      ArcStats::record<T>(ArcStats::kUpgraded);
+      return true; // Immortal objects are always there
+    }
+    return false;
+  }
+
+  /**
+   * @brief Release the WeakArc's weak reference.
+   *
+   * Decrements the weak count of the control block and deletes the control
+   * block if it was the last reference of any kind.
+   */
+  void release() {
+    if (auto block = Handle::counted(control_block)) {
+      block->release_weak();
+    }
+  }
+};
+
+/**
+ * @brief EpochGuard class
+ *
+ * Borrow of an epoch-managed object, returned by `AtomicArc::borrow`. Keeps
+ * the epoch pinned, and with it the object alive, without holding a
+ * reference. Must stay on the thread that created it.
+ *
+ * @tparam T The type of the borrowed object.
+ */
+template <typename T> class EpochGuard {
+private:
+  EpochPin pin; // Pinned epoch
+  T *value;     // Borrowed object, or null
+
+  friend class AtomicArc<T>;
+
+  EpochGuard() : value(nullptr) {}
+
+public:
+  EpochGuard(EpochGuard &&other) = default;
+
+  T *get() const { return value; }
+  T &operator*() const { return *value; }
+  T *operator->() const { return value; }
+  explicit operator bool() const { return value != nullptr; }
+};
+
+/**
+ * @brief MutexGuard class
+ *
+ * RAII guard returned by `Mutex::lock`. Gives exclusive access to the value
+ * for as long as it is alive.
+ *
+ * @tparam T The type of the protected value.
+ */
+template <typename T> class MutexGuard {
+private:
+  std::unique_lock<std::mutex> lock; // Held lock
+  T *value;                          // Protected value
+
+public:
+  MutexGuard(std::unique_lock<std::mutex> lock, T *value)
+      : lock(std::move(lock)), value(value) {}
+
+  T *get() const { return value; }
+  T &operator*() const { return *value; }
+  T *operator->() const { return value; }
+};
+
+/**
+ * @brief Mutex class
+ *
+ * Pairs a value with the `std::mutex` protecting it, for shared mutable data
+ * such as `Arc<Mutex<T>>`. The value can only be reached through a guard.
+ *
+ * @tparam T The type of the protected value.
+ */
+template <typename T> class Mutex {
+private:
+  std::mutex mutex; // Mutex protecting the value
+  T value;          // Protected value
+
+public:
+  /**
+   * @brief Constructor to build the protected value in place.
+   *
+   * @param args Arguments forwarded to the constructor of T.
+   */
+  template <typename... Args>
+  explicit Mutex(Args &&...args) : value(std::forward<Args>(args)...) {}
+
+  /**
+   * @brief Lock the mutex, blocking until it is available.
+   *
+   * @return Guard giving exclusive access to the value.
+   */
+  MutexGuard<T> lock() {
+    return MutexGuard<T>(std::unique_lock<std::mutex>(mutex), &value);
+  }
+
+  /**
+   * @brief Lock the mutex if it is free.
+   *
+   * @return Guard giving exclusive access to the value, or nothing.
+   */
+  std::optional<MutexGuard<T>> try_lock() {
+    std::unique_lock<std::mutex> lock(mutex, std::try_to_lock);
+    if (!lock) {
+      return std::nullopt;
+    }
+    return MutexGuard<T>(std::move(lock), &value);
+  }
+};
+
+/**
+ * @brief RwLockReadGuard class
+ *
+ * RAII guard returned by `RwLock::read`. Gives shared, read-only access to the
+ * value for as long as it is alive.
+ *
+ * @tparam T The type of the protected value.
+ */
+template <typename T> class RwLockReadGuard {
+private:
+  std::shared_lock<std::shared_mutex> lock; // Held shared lock
+  const T *value;                           // Protected value
+
+public:
+  RwLockReadGuard(std::shared_lock<std::shared_mutex> lock, const T *value)
+      : lock(std::move(lock)), value(value) {}
+
+  const T *get() const { return value; }
+  const T &operator*() const { return *value; }
+  const T *operator->() const { return value; }
+};
+
+/**
+ * @brief RwLockWriteGuard class
+ *
+ * RAII guard returned by `RwLock::write`. Gives exclusive access to the value
+ * for as long as it is alive.
+ *
+ * @tparam T The type of the protected value.
+ */
+template <typename T> class RwLockWriteGuard {
+private:
+  std::unique_lock<std::shared_mutex> lock; // Held exclusive lock
+  T *value;                                 // Protected value
+
+public:
+  RwLockWriteGuard(std::unique_lock<std::shared_mutex> lock, T *value)
+      : lock(std::move(lock)), value(value) {}
+
+  T *get() const { return value; }
+  T &operator*() const { return *value; }
+  T *operator->() const { return value; }
+};
+
+/**
+ * @brief RwLock class
+ *
+ * Pairs a value with the `std::shared_mutex` protecting it, for shared data
+ * such as `Arc<RwLock<T>>` that is read often and written rarely. The value
+ * can only be reached through a guard.
+ *
+ * @tparam T The type of the protected value.
+ */
+template <typename T> class RwLock {
+private:
+  mutable std::shared_mutex mutex; // Mutex protecting the value
+  T value;                         // Protected value
+
+public:
+  /**
+   * @brief Constructor to build the protected value in place.
+   *
+   * @param args Arguments forwarded to the constructor of T.
+   */
+  template <typename... Args>
+  explicit RwLock(Args &&...args) : value(std::forward<Args>(args)...) {}
+
+  /**
+   * @brief Acquire a shared lock, blocking while a writer holds the lock.
+   *
+   * @return Guard giving read-only access to the value.
+   */
+  RwLockReadGuard<T> read() const {
+    return RwLockReadGuard<T>(std::shared_lock<std::shared_mutex>(mutex),
+                              &value);
+  }
+
+  /**
+   * @brief Acquire an exclusive lock, blocking while anyone holds the lock.
+   *
+   * @return Guard giving exclusive access to the value.
+   */
+  RwLockWriteGuard<T> write() {
+    return RwLockWriteGuard<T>(std::unique_lock<std::shared_mutex>(mutex),
+                               &value);
+  }
+};
+
+/**
+ * @brief AtomicArc class
+ *
+ * The AtomicArc class is a shared slot holding an Arc that can be loaded and
+ * replaced concurrently from many threads, much like
+ * `std::atomic<std::shared_ptr<T>>`. Every load returns an ordinary Arc
+ * snapshot sharing the stored control block.
+ *
+ * The slot uses a split reference count: it packs the control block pointer
+ * and a local count into one 64-bit word, and keeps a batch of strong
+ * references reserved on the stored block. A load is a single `fetch_add` on
+ * the word, which hands the caller one of the reserved references, so readers
+ * never lock, loop or touch the block's count on the fast path. Writers swap
+ * the word and return the unused part of the batch to the old block.
+ *
+ * @tparam T The type of the object being managed.
+ */
+template <typename T> class AtomicArc {
+private:
+  using Handle = Arc<T>;
+  using BlockBase = typename Handle::BlockBase;
+  using ArcControlBlock = typename Handle::ArcControlBlock;
+
+  static_assert(sizeof(void *) == 8,
+                "AtomicArc packs a 48-bit pointer into a 64-bit word");
+
+  static constexpr int kCountShift = 48;
+  static constexpr std::uint64_t kPointerMask =
+      (std::uint64_t(1) << kCountShift) - 1;
+  static constexpr std::uint64_t kCountOne = std::uint64_t(1) << kCountShift;
+
+  // Strong references reserved on the stored block. The local count must
+  // stay below this value, which the refill threshold keeps it well under.
+  static constexpr int kBatch = 1 << 13;
+  static constexpr int kRefillThreshold = 1 << 10;
+
+  std::atomic<std::uint64_t> word; // Control block pointer and local count
+
+  static BlockBase *block_of(std::uint64_t value) {
+    return reinterpret_cast<BlockBase *>(value & kPointerMask);
+  }
+
+  static int count_of(std::uint64_t value) {
+    return static_cast<int>(value >> kCountShift);
+  }
+
+  // Stored blocks are always Arc<T>'s own, which know their object. Immortal
+  // blocks keep their tag in the word and hold no reserved batch.
+  static T *data_of(BlockBase *block) {
+    return block ? static_cast<ArcControlBlock *>(Handle::untag(block))->data
+                 : nullptr;
+  }
+
+  /**
+   * @brief Turn an Arc into a slot word owning a full batch of references.
+   *
+   * The Arc's own reference becomes part of the batch. A converted or
+   * aliasing Arc, whose block does not know the object it points to, is
+   * first moved into a block of its own.
+   *
+   * @param arc The Arc instance to take over.
+   * @return The packed word, with a local count of zero.
+   */
+  static std::uint64_t reserve(Arc<T> &&arc) {
+    if (Handle::bits_of(arc.control_block) & Handle::kAliasTag) {
+      arc.control_block =
+          new typename Handle::AliasControlBlock(arc.control_block, arc.ptr);
+    }
+    auto block = arc.control_block;
+    if (block) {
+      if (auto counted = Handle::counted(block)) {
+        counted->increment(kBatch - 1);
+      }
+      arc.control_block = nullptr;
+      arc.ptr = nullptr;
+    }
+    return reinterpret_cast<std::uint64_t>(block);
+  }
+
+  /**
+   * @brief Return the references a replaced word still holds to its block.
+   *
+   * @param value The word that was swapped out of the slot.
+   * @param keep Number of references handed to the caller instead.
+   */
+  static void unreserve(std::uint64_t value, int keep) {
+    if (auto block = Handle::counted(block_of(value))) {
+      auto unused = kBatch - count_of(value) - keep;
+      if (unused > 0) {
+        block->release(unused);
+      }
+    }
+  }
+
+  /**
+   * @brief Replenish the reserved batch once readers have used up part of it.
+   *
+   * Adds the handed-out references back to the block, then resets the local
+   * count if the slot still holds the same block. The caller owns a reference
+   * to the block, so undoing a failed attempt cannot free it.
+   *
+   * @param block The block the caller loaded.
+   */
+  void refill(BlockBase *block) {
+    auto expected = word.load(std::memory_order_relaxed);
+    while (block_of(expected) == block &&
+           count_of(expected) >= kRefillThreshold) {
+      auto count = count_of(expected);
+      block->increment(count);
+      if (word.compare_exchange_weak(expected, expected & kPointerMask,
+                                     std::memory_order_release,
+                                     std::memory_order_relaxed)) {
+        return;
+      }
+      block->decrement(count);
+    }
+  }
+
+public:
+  /**
+   * @brief Constructor to create an empty AtomicArc instance.
+   */
+  AtomicArc() : word(0) {}
+
+  /**
+   * @brief Constructor to create an AtomicArc instance holding an Arc.
+   *
+   * @param arc The Arc instance to store.
+   */
+  explicit AtomicArc(Arc<T> arc) : word(reserve(std::move(arc))) {}
+
+  AtomicArc(const AtomicArc &) = delete;
+  AtomicArc &operator=(const AtomicArc &) = delete;
+
+  /**
+   * @brief Destructor.
+   *
+   * Releases the stored Arc.
+   */
+  ~AtomicArc() { unreserve(word.load(std::memory_order_acquire), 0); }
+
+  /**
+   * @brief Load a snapshot of the stored Arc.
+   *
+   * Wait-free on the fast path: a single `fetch_add` on the slot word.
+   *
+   * @return Arc sharing the stored control block, or an empty Arc.
+   */
+  Arc<T> load() {
+    auto value = word.fetch_add(kCountOne, std::memory_order_acquire);
+    auto block = block_of(value);
+    if (!block) {
+      return Arc<T>(nullptr, nullptr);
+    }
+    // The local count of an immortal block is never used and may wrap.
+    if (count_of(value) + 1 >= kRefillThreshold && Handle::counted(block)) {
+      refill(block);
+    }
+    return Arc<T>(block, data_of(block));
+  }
+
+  /**
+   * @brief Borrow the stored object without taking a reference.
+   *
+   * Pins the epoch and reads the slot word; neither the word nor the block's
+   * count is written. Requires `ArcEpochDestruction<T>`, so that the object
+   * outlives the guard even if the slot is replaced meanwhile.
+   *
+   * @return Guard giving access to the stored object, or to null.
+   */
+  EpochGuard<T> borrow() const {
+    static_assert(ArcEpochDestruction<T>::value,
+                  "borrow() needs ArcEpochDestruction<T>");
+    EpochGuard<T> guard;
+    auto block = block_of(word.load(std::memory_order_acquire));
+    guard.value = data_of(block);
+    return guard;
+  }
+
+  /**
+   * @brief Replace the stored Arc.
+   *
+   * @param arc The Arc instance to store.
+   */
+  void store(Arc<T> arc) {
+    unreserve(word.exchange(reserve(std::move(arc)), std::memory_order_acq_rel),
+              0);
+  }
+
+  /**
+   * @brief Replace the stored Arc and return the previous one.
+   *
+   * @param arc The Arc instance to store.
+   * @return The previously stored Arc.
+   */
+  Arc<T> exchange(Arc<T> arc) {
+    auto old =
+        word.exchange(reserve(std::move(arc)), std::memory_order_acq_rel);
+    unreserve(old, 1);
+    auto block = block_of(old);
+    return Arc<T>(block, data_of(block));
+  }
+
+  /**
+   * @brief Replace the stored Arc if it still shares `expected`'s control
+   * block.
+   *
+   * On failure, `expected` is updated to a snapshot of the current value.
+   *
+   * @param expected The Arc the caller expects to be stored.
+   * @param desired The Arc instance to store.
+   * @return True if the slot was updated.
+   */
+  bool compare_exchange(Arc<T> &expected, Arc<T> desired) {
+    auto desired_word = reserve(std::move(desired));
+    auto value = word.load(std::memory_order_relaxed);
+    while (block_of(value) == expected.control_block) {
+      // Readers bumping the local count make this fail spuriously, so retry
+      // for as long as the block itself is unchanged.
+      if (word.compare_exchange_weak(value, desired_word,
+                                     std::memory_order_acq_rel,
+                                     std::memory_order_relaxed)) {
+        unreserve(value, 0);
+        return true;
+      }
+    }
+    unreserve(desired_word, 0);
+    expected = load();
+    return false;
+  }
+};
+
+/**
+ * @brief ArcStack class
+ *
+ * Lock-free stack (Treiber stack) for handing Arc instances between threads.
+ * Arcs are moved in and out of its nodes, so a push and a pop transfer the
+ * reference without touching the count, and each takes a single CAS on the
+ * top of the stack.
+ *
+ * Popped nodes are retired through `ArcEpoch`, and pops are pinned, so a
+ * node is never freed or reused while a pop can still read it; this also
+ * rules out ABA on the top pointer.
+ *
+ * @tparam T The type of the objects being managed.
+ * @tparam Count Counting policy of the Arcs.
+ */
+template <typename T, typename Count = AtomicCount> class ArcStack {
+private:
+  using Handle = Arc<T, Count>;
+
+  static_assert(!std::is_same_v<Count, LocalCount>,
+                "Rc instances must stay on one thread");
+
+  struct Node : ArcEpoch::Node {
+    Node *next = nullptr; // Node below, fixed once pushed
+    union {
+      Handle value; // Arc moved in by push, out by pop
+    };
+
+    explicit Node(Handle &&arc) : value(std::move(arc)) {
+      this->reclaim = [](ArcEpoch::Node *node) noexcept {
+        delete static_cast<Node *>(node);
+      };
+    }
+
+    ~Node() {}
+  };
+
+  std::atomic<Node *> top{nullptr}; // Most recently pushed node
+
+public:
+  ArcStack() = default;
+
+  ArcStack(const ArcStack &) = delete;
+  ArcStack &operator=(const ArcStack &) = delete;
+
+  /**
+   * @brief Destructor, dropping the Arcs still on the stack.
+   *
+   * No other thread may use the stack any more.
+   */
+  ~ArcStack() {
+    auto node = top.load(std::memory_order_acquire);
+    while (node) {
+      auto next = node->next;
+      node->value.~Handle();
+      delete node;
+      node = next;
+    }
+  }
+
+  /**
+   * @brief Push an Arc, taking over its reference.
+   *
+   * @param arc The Arc instance to push; left empty.
+   */
+  void push(Handle &&arc) {
+    auto node = new Node(std::move(arc));
+    node->next = top.load(std::memory_order_relaxed);
+    while (!top.compare_exchange_weak(node->next, node,
+                                      std::memory_order_release,
+                                      std::memory_order_relaxed)) {
+    }
+  }
+
+  /**
+   * @brief Pop the most recently pushed Arc.
+   *
+   * @return The Arc, with the reference it was pushed with, or an empty
+   * optional if the stack is empty.
+   */
+  std::optional<Handle> try_pop() {
+    EpochPin pin;
+    auto node = top.load(std::memory_order_acquire);
+    while (node && !top.compare_exchange_weak(node, node->next,
+                                              std::memory_order_acquire,
+                                              std::memory_order_acquire)) {
+    }
+    if (!node) {
+      return std::nullopt;
+    }
+    std::optional<Handle> result(std::move(node->value));
+    node->value.~Handle();
+    ArcEpoch::retire(node);
+    return result;
+  }
+
+  /**
+   * @brief Check whether the stack is empty; only a hint while other threads
+   * push or pop.
+   */
+  bool empty() const { return !top.load(std::memory_order_acquire); }
+};
+
+/**
+ * @brief ArcQueue class
+ *
+ * Unbounded lock-free MPMC queue (Michael-Scott queue) for handing Arc
+ * instances between threads, such as between pipeline stages. Arcs are moved
+ * in and out of its nodes, so they keep their references and their counts
+ * are never touched. A push allocates a node and links it with one CAS
+ * (plus one to advance the tail); a pop takes one CAS on the head. The head
+ * and the tail sit on separate cache lines, so producers and consumers do not
+ * contend with each other.
+ *
+ * Nodes that leave the queue are retired through `ArcEpoch`, and every
+ * operation is pinned, so no node is freed or reused while another thread
+ * can still reach it.
+ *
+ * @tparam T The type of the objects being managed.
+ * @tparam Count Counting policy of the Arcs.
+ */
+template <typename T, typename Count = AtomicCount> class ArcQueue {
+private:
+  using Handle = Arc<T, Count>;
+
+  static_assert(!std::is_same_v<Count, LocalCount>,
+                "Rc instances must stay on one thread");
+
+  struct Node : ArcEpoch::Node {
+    std::atomic<Node *> next{nullptr}; // Next node towards the tail
+    union {
+      Handle value; // Arc moved in by push, out by pop; none in the dummy
+    };
+
+    Node() {
+      this->reclaim = [](ArcEpoch::Node *node) noexcept {
+        delete static_cast<Node *>(node);
+      };
+    }
+
+    ~Node() {}
+  };
+
+  // The head is a dummy node; the Arcs are in the nodes after it.
+  alignas(kArcCacheLine) std::atomic<Node *> head;
+  alignas(kArcCacheLine) std::atomic<Node *> tail;
+
+public:
+  ArcQueue() {
+    auto dummy = new Node();
+    head.store(dummy, std::memory_order_relaxed);
+    tail.store(dummy, std::memory_order_relaxed);
+  }
+
+  ArcQueue(const ArcQueue &) = delete;
+  ArcQueue &operator=(const ArcQueue &) = delete;
+
+  /**
+   * @brief Destructor, dropping the Arcs still in the queue.
+   *
+   * No other thread may use the queue any more.
+   */
+  ~ArcQueue() {
+    auto node = head.load(std::memory_order_acquire);
+    auto next = node->next.load(std::memory_order_acquire);
+    delete node;
+    while (next) {
+      node = next;
+      next = node->next.load(std::memory_order_acquire);
+      node->value.~Handle();
+      delete node;
+    }
+  }
+
+  /**
+   * @brief Push an Arc at the tail, taking over its reference.
+   *
+   * @param arc The Arc instance to push; left empty.
+   */
+  void push(Handle &&arc) {
+    auto node = new Node();
+    ::new (static_cast<void *>(&node->value)) Handle(std::move(arc));
+    EpochPin pin;
+    for (;;) {
+      auto last = tail.load(std::memory_order_acquire);
+      auto next = last->next.load(std::memory_order_acquire);
+      if (next) {
+        // Another push linked its node but has not advanced the tail yet.
+        tail.compare_exchange_weak(last, next, std::memory_order_release,
+                                   std::memory_order_relaxed);
+      } else if (last->next.compare_exchange_weak(next, node,
+                                                  std::memory_order_release,
+                                                  std::memory_order_relaxed)) {
+        tail.compare_exchange_strong(last, node, std::memory_order_release,
+                                     std::memory_order_relaxed);
+        return;
+      }
+    }
+  }
+
+  /**
+   * @brief Pop the Arc at the head.
+   *
+   * @return The Arc, with the reference it was pushed with, or an empty
+   * optional if the queue is empty.
+   */
+  std::optional<Handle> try_pop() {
+    EpochPin pin;
+    for (;;) {
+      auto first = head.load(std::memory_order_acquire);
+      auto next = first->next.load(std::memory_order_acquire);
+      if (!next) {
+        return std::nullopt;
+      }
+      auto last = tail.load(std::memory_order_acquire);
+      if (first == last) {
+        // Keep the tail from falling behind the head, which retires nodes.
+        tail.compare_exchange_weak(last, next, std::memory_order_release,
+                                   std::memory_order_relaxed);
+        continue;
+      }
+      // Releases as well, so the next pop that reads the head synchronizes
+      // with the push that linked it.
+      if (head.compare_exchange_weak(first, next, std::memory_order_acq_rel,
+                                     std::memory_order_relaxed)) {
+        // `next` is the new dummy. Its Arc is ours, and the pin keeps the
+        // node alive even if another pop retires it meanwhile.
+        std::optional<Handle> result(std::move(next->value));
+        next->value.~Handle();
+        ArcEpoch::retire(first);
+        return result;
+      }
+    }
+  }
+
+  /**
+   * @brief Check whether the queue is empty; only a hint while other threads
+   * push or pop.
+   */
+  bool empty() const {
+    EpochPin pin;
+    return !head.load(std::memory_order_acquire)
+                ->next.load(std::memory_order_acquire);
+  }
+};
+
+/**
+ * @brief BoundedArcQueue class
+ *
+ * Fixed-capacity MPMC queue for handing Arc instances between threads, on a
+ * ring of cells with a sequence number each, after Dmitry Vyukov's bounded
+ * queue. A push and a pop each take a single CAS, on the tail and the head
+ * respectively, and never allocate; the Arcs are moved in and out of the
+ * cells, so their counts are never touched.
+ *
+ * There are no locks, but an operation preempted between its CAS and the
+ * update of its cell holds up the operations that reach that cell next.
+ *
+ * @tparam T The type of the objects being managed.
+ * @tparam Count Counting policy of the Arcs.
+ */
+template <typename T, typename Count = AtomicCount> class BoundedArcQueue {
+private:
+  using Handle = Arc<T, Count>;
+
+  static_assert(!std::is_same_v<Count, LocalCount>,
+                "Rc instances must stay on one thread");
+
+  struct Cell {
+    // Equal to the position that may push into the cell next, or to one
+    // past the position that may pop from it.
+    std::atomic<std::size_t> sequence;
+    union {
+      Handle value; // Arc moved in by push, out by pop
+    };
+
+    Cell() {}
+    ~Cell() {}
+  };
+
+  std::unique_ptr<Cell[]> cells; // Ring of a power-of-two size
+  std::size_t mask;              // Ring size minus one
+  alignas(kArcCacheLine) std::atomic<std::size_t> head{0}; // Next to pop
+  alignas(kArcCacheLine) std::atomic<std::size_t> tail{0}; // Next to push
+
+  // A single cell could not tell a full ring from an empty one.
+  static std::size_t ring_size(std::size_t capacity) {
+    std::size_t size = 2;
+    while (size < capacity) {
+      size *= 2;
+    }
+    return size;
+  }
+
+public:
+  /**
+   * @brief Constructor to allocate the ring.
+   *
+   * @param capacity Minimum number of Arcs the queue holds; rounded up to a
+   * power of two, and to at least two.
+   */
+  explicit BoundedArcQueue(std::size_t capacity)
+      : cells(new Cell[ring_size(capacity)]),
+        mask(ring_size(capacity) - 1) {
+    for (std::size_t i = 0; i <= mask; ++i) {
+      cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  BoundedArcQueue(const BoundedArcQueue &) = delete;
+  BoundedArcQueue &operator=(const BoundedArcQueue &) = delete;
+
+  /**
+   * @brief Destructor, dropping the Arcs still in the queue.
+   *
+   * No other thread may use the queue any more.
+   */
+  ~BoundedArcQueue() {
+    while (try_pop()) {
+    }
+  }
+
+  /**
+   * @brief Push an Arc at the tail unless the queue is full.
+   *
+   * @param arc The Arc instance to push; left empty on success and untouched
+   * otherwise.
+   * @return True if the Arc was pushed.
+   */
+  bool try_push(Handle &&arc) {
+    auto position = tail.load(std::memory_order_relaxed);
+    for (;;) {
+      auto &cell = cells[position & mask];
+      auto sequence = cell.sequence.load(std::memory_order_acquire);
+      auto lag = static_cast<std::ptrdiff_t>(sequence - position);
+      if (lag == 0) {
+        if (tail.compare_exchange_weak(position, position + 1,
+                                       std::memory_order_relaxed)) {
+          ::new (static_cast<void *>(&cell.value)) Handle(std::move(arc));
+          cell.sequence.store(position + 1, std::memory_order_release);
+          return true;
+        }
+      } else if (lag < 0) {
+        return false; // The cell still holds an Arc from a lap ago
+      } else {
+        position = tail.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  /**
+   * @brief Pop the Arc at the head.
+   *
+   * @return The Arc, with the reference it was pushed with, or an empty
+   * optional if the queue is empty.
+   */
+  std::optional<Handle> try_pop() {
+    auto position = head.load(std::memory_order_relaxed);
+    for (;;) {
+      auto &cell = cells[position & mask];
+      auto sequence = cell.sequence.load(std::memory_order_acquire);
+      auto lag = static_cast<std::ptrdiff_t>(sequence - (position + 1));
+      if (lag == 0) {
+        if (head.compare_exchange_weak(position, position + 1,
+                                       std::memory_order_relaxed)) {
+          std::optional<Handle> result(std::move(cell.value));
+          cell.value.~Handle();
+          cell.sequence.store(position + mask + 1, std::memory_order_release);
+          return result;
+        }
+      } else if (lag < 0) {
+        return std::nullopt; // Nothing pushed into the cell yet
+      } else {
+        position = head.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  /**
+   * @brief Get the number of Arcs the queue holds when full.
+   */
+  std::size_t capacity() const { return mask + 1; }
+};
+
+
+/**
+ * @brief ShardedArc class
+ *
+ * Arc flavor for the few objects that every thread clones all the time, such
+ * as a global schema or allocator. A single reference count would bounce
+ * between the cores; instead the control block keeps one cache-line-padded
+ * count per stripe, and each thread copies onto its own stripe.
+ *
+ * Every ShardedArc instance remembers the stripe its reference was taken on
+ * and drops it there, so a stripe count is exactly the number of instances
+ * on it. A central count tracks how many stripes are nonzero, in the manner
+ * of a SNZI: only a stripe's first reference and its last drop touch it.
+ * The object is destroyed when the central count reaches zero.
+ *
+ * Each block takes `Stripes` cache lines, and ShardedArc has no weak
+ * references; use it for long-lived hot objects and plain Arc elsewhere.
+ *
+ * @tparam T The type of the object being managed.
+ * @tparam Stripes Number of per-thread counts in the control block.
+ */
+template <typename T, std::size_t Stripes = 64> class ShardedArc {
+private:
+  static constexpr std::size_t kCacheLine = kArcCacheLine;
+
+  struct ShardedControlBlock;
+
+  /**
+   * @brief One thread's share of the reference count, on its own cache line.
+   */
+  struct alignas(kCacheLine) Stripe {
+    std::atomic<long> count{0};           // Instances holding this stripe
+    ShardedControlBlock *block = nullptr; // Block the stripe belongs to
+  };
+
+  /**
+   * @brief Control block holding the stripes, the central count and the
+   * object inline.
+   */
+  struct ShardedControlBlock {
+    Stripe stripes[Stripes];
+    alignas(kCacheLine) std::atomic<long> nonzero{0}; // Nonzero stripes
+    union {
+      T value; // Object constructed in place
+    };
+
+    /**
+     * @brief Constructor to build the object in place.
+     *
+     * @param args Arguments forwarded to the constructor of T.
+     */
+    template <typename... Args> explicit ShardedControlBlock(Args &&...args) {
+      for (auto &stripe : stripes) {
+        stripe.block = this;
+      }
+      ::new (const_cast<void *>(
+          static_cast<const volatile void *>(std::addressof(value))))
+          T(std::forward<Args>(args)...);
+    }
+
+    ~ShardedControlBlock() { value.~T(); }
+  };
+
+  Stripe *stripe; // Stripe holding this instance's reference
+  T *ptr;         // Pointer to data
+
+  template <typename U, std::size_t N, typename... Args>
+  friend ShardedArc<U, N> make_sharded_arc(Args &&...args);
+
+  /**
+   * @brief Stripe index of the calling thread, assigned round-robin.
+   */
+  static std::size_t thread_stripe() {
+    static std::atomic<std::size_t> next{0};
+    thread_local std::size_t index =
+        next.fetch_add(1, std::memory_order_relaxed) % Stripes;
+    return index;
+  }
+
+  /**
+   * @brief Take a reference on the calling thread's stripe.
+   *
+   * A stripe's count only reaches zero once all of its instances are gone,
+   * and the new one is not published yet, so marking the stripe nonzero after
+   * the fact cannot race with its last drop. The caller keeps the object
+   * alive meanwhile.
+   *
+   * @param block The block to reference.
+   * @return The stripe now holding the reference.
+   */
+  static Stripe *acquire(ShardedControlBlock *block) {
+    auto &stripe = block->stripes[thread_stripe()];
+    if (stripe.count.fetch_add(1, std::memory_order_relaxed) == 0) {
+      block->nonzero.fetch_add(1, std::memory_order_relaxed);
+    }
+    return &stripe;
+  }
+
+  /**
+   * @brief Constructor used by `make_sharded_arc`.
+   *
+   * @param block The new block, whose only reference this becomes.
+   */
+  explicit ShardedArc(ShardedControlBlock *block)
+      : stripe(acquire(block)), ptr(&block->value) {}
+
+public:
+  /**
+   * @brief Copy constructor.
+   *
+   * The copy takes its reference on the calling thread's stripe.
+   *
+   * @param other The ShardedArc instance to copy from.
+   */
+  ShardedArc(const ShardedArc &other)
+      : stripe(other.stripe ? acquire(other.stripe->block) : nullptr),
+        ptr(other.ptr) {}
+
+  /**
+   * @brief Move constructor.
+   *
+   * @param other The ShardedArc instance to move from.
+   */
+  ShardedArc(ShardedArc &&other) noexcept
+      : stripe(other.stripe), ptr(other.ptr) {
+    other.stripe = nullptr;
+    other.ptr = nullptr;
+  }
+
+  /**
+   * @brief Assignment operator.
+   *
+   * @param other The ShardedArc instance to assign from.
+   * @return Reference to the assigned ShardedArc instance.
+   */
+  ShardedArc &operator=(const ShardedArc &other) {
+    if (this != &other) {
+      ShardedArc copy(other);
+      std::swap(stripe, copy.stripe);
+      std::swap(ptr, copy.ptr);
+    }
+    return *this;
+  }
+
+  /**
+   * @brief Move assignment operator.
+   *
+   * The old reference is dropped last, so the old object may own `other`.
+   *
+   * @param other The ShardedArc instance to move from.
+   * @return Reference to the assigned ShardedArc instance.
+   */
+  ShardedArc &operator=(ShardedArc &&other) noexcept {
+    if (this != &other) {
+      ShardedArc moved(std::move(other));
+      std::swap(stripe, moved.stripe);
+      std::swap(ptr, moved.ptr);
+    }
+    return *this;
+  }
+
+  /**
+   * @brief Destructor.
+   *
+   * Drops the reference from the stripe it was taken on; the last drop on a
+   * stripe also updates the central count.
+   */
+  ~ShardedArc() { release(); }
+
+  /**
+   * @brief Get the raw pointer to the managed object.
+   *
+   * @return Raw pointer to the managed object.
+   */
+  T *get() const { return ptr; }
+
+  /**
+   * @brief Clone the ShardedArc instance on the calling thread's stripe.
+   *
+   * @return A new ShardedArc instance sharing the same object.
+   */
+  ShardedArc clone() const { return ShardedArc(*this); }
+
+private:
+  void release() {
+    if (!stripe) {
+      return;
+    }
+    if (stripe->count.fetch_sub(1, std::memory_order_release) == 1) {
+      arc_acquire_fence(stripe->count);
+      auto block = stripe->block;
+      if (block->nonzero.fetch_sub(1, std::memory_order_release) == 1) {
+        arc_acquire_fence(block->nonzero);
+        delete block;
+      }
+    }
+    stripe = nullptr;
+    ptr = nullptr;
+  }
+};
+
+/**
+ * @brief Create a ShardedArc instance with the object stored in its control
+ * block.
+ *
+ * @tparam T Type of the object.
+ * @tparam Stripes Number of per-thread counts in the control block.
+ * @param args Arguments forwarded to the constructor of T.
+ * @return ShardedArc instance managing the new object.
+ */
+template <typename T, std::size_t Stripes = 64, typename... Args>
+ShardedArc<T, Stripes> make_sharded_arc(Args &&...args) {
+  return ShardedArc<T, Stripes>(
+      new typename ShardedArc<T, Stripes>::ShardedControlBlock(
+          std::forward<Args>(args)...));
+}
+
+
+/**
+ * @brief ArcSlice class
+ *
+ * Shared, reference-counted array whose elements live in the same allocation
+ * as the control block, starting on a cache line boundary right after it.
+ * Compared with `Arc<std::vector<T>>`, reaching an element takes one pointer
+ * chase and each buffer one allocation, and the elements are contiguous and
+ * aligned for SIMD loads.
+ *
+ * An ArcSlice views a range of its array. `slice` returns a narrower view
+ * sharing the same block, so a sub-slice keeps the whole array alive.
+ *
+ * @tparam T The element type.
+ * @tparam Count Counting policy providing the reference counts.
+ */
+template <typename T, typename Count = AtomicCount> class ArcSlice {
+private:
+  static constexpr std::size_t kAlignment =
+      alignof(T) > kArcCacheLine ? alignof(T) : kArcCacheLine;
+
+  /**
+   * @brief Control block followed in memory by the element array.
+   */
+  struct ArrayControlBlock final : ArcControlBlockBase<Count> {
+    std::size_t size; // Number of elements in the array
+
+    explicit ArrayControlBlock(std::size_t size) : size(size) {}
+
+    /**
+     * @brief Offset of the first element from the start of the block.
+     */
+    static constexpr std::size_t offset() {
+      return (sizeof(ArrayControlBlock) + kAlignment - 1) / kAlignment *
+             kAlignment;
+    }
+
+    T *elements() {
+      return reinterpret_cast<T *>(reinterpret_cast<unsigned char *>(this) +
+                                   offset());
+    }
+
+    /**
+     * @brief Allocate a block with room for `size` elements, not yet
+     * constructed.
+     */
+    static ArrayControlBlock *allocate(std::size_t size) {
+      if (size > (std::size_t(-1) - offset()) / sizeof(T)) {
+        throw std::bad_array_new_length();
+      }
+      auto memory = ::operator new(offset() + size * sizeof(T),
+                                   std::align_val_t(kAlignment));
+      return ::new (memory) ArrayControlBlock(size);
+    }
+
+    void destroy() noexcept override {
+      auto array = elements();
+      for (auto i = size; i > 0; --i) {
+        array[i - 1].~T();
+      }
+    }
+
+    void deallocate() noexcept override {
+      this->~ArrayControlBlock();
+      ::operator delete(static_cast<void *>(this),
+                        std::align_val_t(kAlignment));
+    }
+  };
+
+  ArrayControlBlock *block; // Block holding the array, or null
+  T *first;                 // First element of the view
+  std::size_t length;       // Number of elements in the view
+
+  template <typename U, typename C, typename Init>
+  friend ArcSlice<U, C> make_arc_array_with(std::size_t size, Init init);
+
+  ArcSlice(ArrayControlBlock *block, T *first, std::size_t length)
+      : block(block), first(first), length(length) {}
+
+public:
+  using value_type = T;
+  using iterator = T *;
+  using const_iterator = const T *;
+
+  /**
+   * @brief Constructor to create an empty ArcSlice instance.
+   */
+  ArcSlice() : block(nullptr), first(nullptr), length(0) {}
+
+  /**
+   * @brief Copy constructor.
+   *
+   * @param other The ArcSlice instance to copy from.
+   */
+  ArcSlice(const ArcSlice &other)
+      : block(other.block), first(other.first), length(other.length) {
+    if (block) {
+      block->increment();
+    }
+  }
+
+  /**
+   * @brief Move constructor.
+   *
+   * @param other The ArcSlice instance to move from.
+   */
+  ArcSlice(ArcSlice &&other) noexcept
+      : block(other.block), first(other.first), length(other.length) {
+    other.block = nullptr;
+    other.first = nullptr;
+    other.length = 0;
+  }
+
+  /**
+   * @brief Assignment operator.
+   *
+   * The old block is released last, so its elements may own `other`.
+   *
+   * @param other The ArcSlice instance to assign.
+   * @return Reference to the assigned ArcSlice instance.
+   */
+  ArcSlice &operator=(const ArcSlice &other) {
+    ArcSlice copy(other);
+    std::swap(block, copy.block);
+    std::swap(first, copy.first);
+    std::swap(length, copy.length);
+    return *this;
+  }
+
+  /**
+   * @brief Move assignment operator.
+   *
+   * The old block is released last, so its elements may own `other`.
+   *
+   * @param other The ArcSlice instance to move from.
+   * @return Reference to the assigned ArcSlice instance.
+   */
+  ArcSlice &operator=(ArcSlice &&other) noexcept {
+    if (this != &other) {
+      ArcSlice moved(std::move(other));
+      std::swap(block, moved.block);
+      std::swap(first, moved.first);
+      std::swap(length, moved.length);
+    }
+    return *this;
+  }
+
+  /**
+   * @brief Destructor.
+   *
+   * Destroys the elements and frees the block once the last slice sharing it
+   * is gone.
+   */
+  ~ArcSlice() { release(); }
+
+  T *data() const { return first; }
+  std::size_t size() const { return length; }
+  bool empty() const { return length == 0; }
+
+  T *begin() const { return first; }
+  T *end() const { return first + length; }
+
+  T &operator[](std::size_t index) const { return first[index]; }
+
+  /**
+   * @brief Get a view of part of this slice, sharing the same block.
+   *
+   * Zero-copy: the result only takes a reference on the block, which keeps
+   * the whole array alive.
+   *
+   * @param offset Index of the first element of the view.
+   * @param count Maximum number of elements; clamped to the end of the slice.
+   * @return The narrower ArcSlice.
+   * @throws std::out_of_range If `offset` is past the end of the slice.
+   */
+  ArcSlice slice(std::size_t offset,
+                 std::size_t count = std::size_t(-1)) const {
+    if (offset > length) {
+      throw std::out_of_range("ArcSlice::slice: offset out of range");
+    }
+    if (block) {
+      block->increment();
+    }
+    return ArcSlice(block, first + offset,
+                    count < length - offset ? count : length - offset);
+  }
+
+  /**
+   * @brief Clone the ArcSlice instance.
+   *
+   * @return A new ArcSlice instance viewing the same elements.
+   */
+  ArcSlice clone() const { return ArcSlice(*this); }
+
+private:
+  void release() {
+    if (block) {
+      block->release();
+    }
+  }
+};
+
+/**
+ * @brief Create an ArcSlice, constructing each element with a callback.
+ *
+ * Implementation of `make_arc_array`. If a constructor throws, the elements
+ * built so far are destroyed and the block is freed.
+ *
+ * @tparam T Element type.
+ * @tparam Count Counting policy of the result.
+ * @param size Number of elements.
+ * @param init Called as init(address, index) to construct each element.
+ * @return ArcSlice viewing the whole array.
+ */
+template <typename T, typename Count, typename Init>
+ArcSlice<T, Count> make_arc_array_with(std::size_t size, Init init) {
+  using Block = typename ArcSlice<T, Count>::ArrayControlBlock;
+  auto block = Block::allocate(size);
+  auto elements = block->elements();
+  std::size_t built = 0;
+  try {
+    for (; built < size; ++built) {
+      init(static_cast<void *>(elements + built), built);
+    }
+  } catch (...) {
+    block->size = built;
+    block->destroy();
+    block->deallocate();
+    throw;
+  }
+  return ArcSlice<T, Count>(block, elements, size);
+}
+
+/**
+ * @brief Create an ArcSlice of `size` value-initialized elements.
+ *
+ * @tparam T Element type.
+ * @tparam Count Counting policy of the result.
+ * @param size Number of elements.
+ * @return ArcSlice viewing the new array.
+ */
+template <typename T, typename Count = AtomicCount>
+ArcSlice<T, Count> make_arc_array(std::size_t size) {
+  return make_arc_array_with<T, Count>(
+      size, [](void *where, std::size_t) { ::new (where) T(); });
+}
+
+/**
+ * @brief Create an ArcSlice of `size` copies of `value`.
+ *
+ * @tparam T Element type.
+ * @tparam Count Counting policy of the result.
+ * @param size Number of elements.
+ * @param value Value to copy into every element.
+ * @return ArcSlice viewing the new array.
+ */
+template <typename T, typename Count = AtomicCount>
+ArcSlice<T, Count> make_arc_array(std::size_t size, const T &value) {
+  return make_arc_array_with<T, Count>(
+      size, [&](void *where, std::size_t) { ::new (where) T(value); });
+}
+
+/**
+ * @brief Create an ArcSlice holding a copy of the range [first, last).
+ *
+ * @tparam T Element type.
+ * @tparam Count Counting policy of the result.
+ * @param first Start of the range.
+ * @param last End of the range.
+ * @return ArcSlice viewing the new array.
+ */
+template <typename T, typename Count = AtomicCount, typename Iterator,
+          typename = std::enable_if_t<!std::is_integral_v<Iterator>>>
+ArcSlice<T, Count> make_arc_array(Iterator first, Iterator last) {
+  auto size = static_cast<std::size_t>(std::distance(first, last));
+  return make_arc_array_with<T, Count>(
+      size, [&](void *where, std::size_t) { ::new (where) T(*first++); });
+}
+
+
+/**
+ * @brief ArcStr class
+ *
+ * Immutable, reference-counted string for interned keys and other strings
+ * that are shared and hashed often. Strings of up to 15 characters are stored
+ * in the ArcStr itself. Longer ones live in a single block holding the
+ * reference counts, the length, a hash computed once at construction and the
+ * characters, so copying is a count increment and hashing is a load.
+ *
+ * Equality first checks whether both sides share a block, then compares the
+ * cached hashes, and only then the characters.
+ */
+class ArcStr {
+private:
+  /**
+   * @brief Control block followed in memory by the characters.
+   */
+  struct StringControlBlock final : ArcControlBlockBase<AtomicCount> {
+    std::size_t size; // Number of characters, without the terminator
+    std::size_t hash; // Hash of the characters
+
+    explicit StringControlBlock(std::string_view text)
+        : size(text.size()), hash(std::hash<std::string_view>()(text)) {
+      std::memcpy(chars(), text.data(), size);
+      chars()[size] = '\0';
+    }
+
+    char *chars() { return reinterpret_cast<char *>(this + 1); }
+
+    static StringControlBlock *create(std::string_view text) {
+      auto memory =
+          ::operator new(sizeof(StringControlBlock) + text.size() + 1);
+      return ::new (memory) StringControlBlock(text);
+    }
+
+    void destroy() noexcept override {}
+
+    void deallocate() noexcept override {
+      this->~StringControlBlock();
+      ::operator delete(static_cast<void *>(this));
+    }
+  };
+
+  // Inline strings keep `kSmallCapacity - size` in the last byte, which
+  // doubles as the terminator of a full-length inline string.
+  static constexpr std::size_t kStorage = 16;
+  static constexpr std::size_t kSmallCapacity = kStorage - 1;
+  static constexpr unsigned char kHeapTag = 0xff; // Last byte of a block
+
+  alignas(StringControlBlock *) unsigned char storage[kStorage]; // Contents
+
+  bool is_heap() const { return storage[kSmallCapacity] == kHeapTag; }
+
+  StringControlBlock *block() const {
+    StringControlBlock *block;
+    std::memcpy(&block, storage, sizeof(block));
+    return block;
+  }
+
+  void set_block(StringControlBlock *block) {
+    std::memcpy(storage, &block, sizeof(block));
+    storage[kSmallCapacity] = kHeapTag;
+  }
+
+  void set_small(std::string_view text) {
+    std::memset(storage, 0, kStorage); // Zero padding, so memcmp compares
+    if (!text.empty()) {
+      std::memcpy(storage, text.data(), text.size());
+    }
+    storage[kSmallCapacity] =
+        static_cast<unsigned char>(kSmallCapacity - text.size());
+  }
+
+  void release() {
+    if (is_heap()) {
+      block()->release();
+    }
+  }
+
+public:
+  /**
+   * @brief Constructor to create an empty ArcStr instance.
+   */
+  ArcStr() { set_small(std::string_view()); }
+
+  /**
+   * @brief Constructor to create an ArcStr instance holding a copy of text.
+   *
+   * @param text The characters to copy.
+   */
+  explicit ArcStr(std::string_view text) {
+    if (text.size() <= kSmallCapacity) {
+      set_small(text);
+    } else {
+      set_block(StringControlBlock::create(text));
+    }
+  }
+
+  /**
+   * @brief Copy constructor.
+   *
+   * @param other The ArcStr instance to copy from.
+   */
+  ArcStr(const ArcStr &other) {
+    std::memcpy(storage, other.storage, kStorage);
+    if (is_heap()) {
+      block()->increment();
+    }
+  }
+
+  /**
+   * @brief Move constructor.
+   *
+   * @param other The ArcStr instance to move from; left empty.
+   */
+  ArcStr(ArcStr &&other) noexcept {
+    std::memcpy(storage, other.storage, kStorage);
+    other.set_small(std::string_view());
+  }
+
+  /**
+   * @brief Assignment operator.
+   *
+   * The old block is released last, once this instance holds the new one.
+   *
+   * @param other The ArcStr instance to assign.
+   * @return Reference to the assigned ArcStr instance.
+   */
+  ArcStr &operator=(const ArcStr &other) {
+    ArcStr copy(other);
+    std::swap(storage, copy.storage);
+    return *this;
+  }
+
+  /**
+   * @brief Move assignment operator.
+   *
+   * The old block is released last, once this instance holds the new one.
+   *
+   * @param other The ArcStr instance to move from; left empty.
+   * @return Reference to the assigned ArcStr instance.
+   */
+  ArcStr &operator=(ArcStr &&other) noexcept {
+    if (this != &other) {
+      ArcStr moved(std::move(other));
+      std::swap(storage, moved.storage);
+    }
+    return *this;
+  }
+
+  /**
+   * @brief Destructor.
+   */
+  ~ArcStr() { release(); }
+
+  /**
+   * @brief Get the characters, followed by a terminating null.
+   */
+  const char *data() const {
+    return is_heap() ? block()->chars()
+                     : reinterpret_cast<const char *>(storage);
+  }
+
+  const char *c_str() const { return data(); }
+
+  std::size_t size() const {
+    return is_heap() ? block()->size : kSmallCapacity - storage[kSmallCapacity];
+  }
+
+  bool empty() const { return size() == 0; }
+
+  std::string_view view() const { return std::string_view(data(), size()); }
+
+  operator std::string_view() const { return view(); }
+
+  /**
+   * @brief Get the hash of the characters.
+   *
+   * Equal to `std::hash<std::string_view>` of the same characters, so maps
+   * can be probed with plain string views. Cached for strings stored in a
+   * block, and computed over at most 15 characters otherwise.
+   */
+  std::size_t hash() const {
+    return is_heap() ? block()->hash : std::hash<std::string_view>()(view());
+  }
+
+  friend bool operator==(const ArcStr &lhs, const ArcStr &rhs) {
+    if (lhs.is_heap() != rhs.is_heap()) {
+      return false; // Lengths differ
+    }
+    if (!lhs.is_heap()) {
+      return std::memcmp(lhs.storage, rhs.storage, kStorage) == 0;
+    }
+    auto left = lhs.block();
+    auto right = rhs.block();
+    return left == right ||
+           (left->hash == right->hash && lhs.view() == rhs.view());
+  }
+
+  friend bool operator!=(const ArcStr &lhs, const ArcStr &rhs) {
+    return !(lhs == rhs);
+  }
+
+  friend bool operator<(const ArcStr &lhs, const ArcStr &rhs) {
+    return lhs.view() < rhs.view();
+  }
+
+  friend std::ostream &operator<<(std::ostream &out, const ArcStr &text) {
+    return out << text.view();
+  }
+};
+
+namespace std {
+template <> struct hash<ArcStr> {
+  std::size_t operator()(const ArcStr &text) const { return text.hash(); }
+};
+} // namespace std
+
+/**
+ * @brief PersistentChunk class
+ *
+ * Fixed-capacity array of up to N elements stored inline, the node payload of
+ * the persistent containers below. Keeping the elements inline makes every
+ * node a single `make_arc` block.
+ *
+ * @tparam T The element type.
+ * @tparam N Maximum number of elements.
+ */
+template <typename T, std::size_t N> class PersistentChunk {
+private:
+  std::size_t count = 0; // Number of constructed elements
+  union {
+    T items[N]; // Elements [0, count) are constructed
+  };
+
+public:
+  PersistentChunk() {}
+
+  PersistentChunk(const PersistentChunk &other) {
+    try {
+      for (std::size_t i = 0; i < other.count; ++i) {
+        push_back(other.items[i]);
+      }
+    } catch (...) {
+      clear();
+      throw;
+    }
+  }
+
+  PersistentChunk &operator=(const PersistentChunk &) = delete;
+
+  ~PersistentChunk() { clear(); }
+
+  std::size_t size() const { return count; }
+  bool empty() const { return count == 0; }
+
+  T &operator[](std::size_t index) { return items[index]; }
+  const T &operator[](std::size_t index) const { return items[index]; }
+
+  T &back() { return items[count - 1]; }
+  const T &back() const { return items[count - 1]; }
+
+  T *begin() { return items; }
+  T *end() { return items + count; }
+  const T *begin() const { return items; }
+  const T *end() const { return items + count; }
+
+  /**
+   * @brief Append an element; the chunk must not be full.
+   *
+   * @param value The element to append.
+   */
+  void push_back(T value) {
+    ::new (static_cast<void *>(items + count)) T(std::move(value));
+    ++count;
+  }
+
+  /**
+   * @brief Insert an element before `index`; the chunk must not be full.
+   *
+   * @param index Position of the new element.
+   * @param value The element to insert.
+   */
+  void insert(std::size_t index, T value) {
+    push_back(std::move(value));
+    std::rotate(items + index, items + count - 1, items + count);
+  }
+
+  /**
+   * @brief Remove the element at `index`, moving the later ones down.
+   *
+   * @param index Position of the element to remove.
+   */
+  void erase(std::size_t index) {
+    std::move(items + index + 1, items + count, items + index);
+    pop_back();
+  }
+
+  void pop_back() { items[--count].~T(); }
+
+  void clear() {
+    while (count) {
+      pop_back();
+    }
+  }
+};
+
+/**
+ * @brief PersistentVector class
+ *
+ * Immutable vector with structural sharing: a 32-way trie of `make_arc`
+ * nodes, with the last (up to) 32 elements in a separate tail node, in the
+ * manner of Clojure's vectors. An update returns a new vector that copies
+ * only the nodes on the path to the changed element, O(log32 n) of them, and
+ * shares all the others with the original; appends mostly touch the tail
+ * alone. Copying a vector, to keep a snapshot, copies two Arcs.
+ *
+ * Nodes are copied on write only while they are shared, as `make_mut` does:
+ * updating a vector no snapshot shares, such as an rvalue or a `Transient`,
+ * edits its nodes in place. A `Transient` thus applies a batch of edits with
+ * one copy of each touched node at most.
+ *
+ * Vectors may be read from many threads at once, and different copies
+ * updated concurrently; one vector must not be updated while it is read.
+ *
+ * @tparam T The element type, which must be copyable.
+ * @tparam Count Counting policy of the nodes.
+ */
+template <typename T, typename Count = AtomicCount> class PersistentVector {
+private:
+  static constexpr unsigned kBits = 5; // Index bits per level
+  static constexpr std::size_t kWidth = std::size_t(1) << kBits;
+  static constexpr std::size_t kMask = kWidth - 1;
+
+  // Branches and leaves share a base only so that a branch can hold either,
+  // depending on its level; each node knows its own type.
+  struct Node {};
+  using NodeArc = Arc<Node, Count>;
+
+  struct Leaf : Node {
+    PersistentChunk<T, kWidth> values;
+  };
+
+  struct Branch : Node {
+    PersistentChunk<NodeArc, kWidth> children;
+  };
+
+  std::size_t count = 0;       // Number of elements
+  unsigned shift = kBits;      // Index bits below the root's level
+  std::optional<NodeArc> root; // Branch over all leaves but the tail, if any
+  std::optional<NodeArc> tail; // Leaf with the last elements, if any
+
+  /**
+   * @brief Get a node for editing, copying it first if it is shared.
+   *
+   * @tparam N The type of the node, Leaf or Branch.
+   * The copy is made before `slot` changes, so a copy of an element that
+   * throws leaves the trie as it was.
+   *
+   * @param slot The Arc holding the node, which is updated to the copy.
+   * @return The node, owned by `slot` alone.
+   */
+  template <typename N> static N &own(NodeArc &slot) {
+    if (!slot.get_mut_if_unique()) {
+      slot = make_arc<N, Count>(*static_cast<const N *>(slot.get()));
+    }
+    return *static_cast<N *>(slot.get());
+  }
+
+  /**
+   * @brief Index of the first element in the tail.
+   */
+  std::size_t tail_offset() const {
+    return count < kWidth ? 0 : ((count - 1) >> kBits) << kBits;
+  }
+
+  static const Branch &branch_of(const NodeArc &slot) {
+    return *static_cast<const Branch *>(slot.get());
+  }
+
+  /**
+   * @brief Get the leaf holding an element.
+   *
+   * @param index Index of the element, less than `size()`.
+   * @return The Arc holding the leaf.
+   */
+  const NodeArc &leaf_at(std::size_t index) const {
+    if (index >= tail_offset()) {
+      return *tail;
+    }
+    auto slot = &*root;
+    for (auto level = shift; level > 0; level -= kBits) {
+      slot = &branch_of(*slot).children[(index >> level) & kMask];
+    }
+    return *slot;
+  }
+
+  static NodeArc make_branch(NodeArc child) {
+    auto branch = make_arc<Branch, Count>();
+    branch.get()->children.push_back(std::move(child));
+    return branch;
+  }
+
+  /**
+   * @brief Build the chain of branches leading from `level` down to a leaf.
+   */
+  static NodeArc new_path(unsigned level, NodeArc leaf) {
+    if (level == 0) {
+      return leaf;
+    }
+    return make_branch(new_path(level - kBits, std::move(leaf)));
+  }
+
+  /**
+   * @brief Add a full leaf after the last one of the tree under `slot`.
+   *
+   * @param slot The branch at `level`.
+   * @param level Index bits below the branch.
+   * @param leaf The leaf to add.
+   */
+  void insert_leaf(NodeArc &slot, unsigned level, NodeArc leaf) {
+    auto &branch = own<Branch>(slot);
+    auto index = ((count - 1) >> level) & kMask;
+    if (level == kBits) {
+      branch.children.push_back(std::move(leaf));
+    } else if (index < branch.children.size()) {
+      insert_leaf(branch.children[index], level - kBits, std::move(leaf));
+    } else {
+      branch.children.push_back(new_path(level - kBits, std::move(leaf)));
+    }
+  }
+
+  /**
+   * @brief Add the full tail to the tree, adding a level if it is full.
+   *
+   * The tail and the root are shared rather than moved into the new nodes,
+   * so they are still in place if allocating a node throws.
+   */
+  void push_tail() {
+    auto leaf = *tail;
+    if (!root) {
+      root = make_branch(std::move(leaf));
+      shift = kBits;
+    } else if ((count >> kBits) > (std::size_t(1) << shift)) {
+      auto branch = make_branch(*root);
+      static_cast<Branch *>(branch.get())
+          ->children.push_back(new_path(shift, std::move(leaf)));
+      root = std::move(branch);
+      shift += kBits;
+    } else {
+      insert_leaf(*root, shift, std::move(leaf));
+    }
+  }
+
+  /**
+   * @brief Remove the last leaf of the tree under `slot`.
+   *
+   * @return True if the branch is left empty.
+   */
+  static bool remove_last_leaf(NodeArc &slot, unsigned level) {
+    auto &branch = own<Branch>(slot);
+    if (level > kBits &&
+        !remove_last_leaf(branch.children.back(), level - kBits)) {
+      return false;
+    }
+    branch.children.pop_back();
+    return branch.children.empty();
+  }
+
+  void assign_in(NodeArc &slot, unsigned level, std::size_t index, T value) {
+    auto &child = own<Branch>(slot).children[(index >> level) & kMask];
+    if (level == kBits) {
+      own<Leaf>(child).values[index & kMask] = std::move(value);
+    } else {
+      assign_in(child, level - kBits, index, std::move(value));
+    }
+  }
+
+  void push_in_place(T value) {
+    if (!tail) {
+      tail = make_arc<Leaf, Count>();
+    } else if (count - tail_offset() == kWidth) {
+      // The new tail is filled before the old one joins the tree, so that
+      // nothing has changed if either step throws.
+      auto fresh = make_arc<Leaf, Count>();
+      static_cast<Leaf *>(fresh.get())->values.push_back(std::move(value));
+      push_tail();
+      tail = std::move(fresh);
+      ++count;
+      return;
+    }
+    own<Leaf>(*tail).values.push_back(std::move(value));
+    ++count;
+  }
+
+  void set_in_place(std::size_t index, T value) {
+    if (index >= tail_offset()) {
+      own<Leaf>(*tail).values[index & kMask] = std::move(value);
+    } else {
+      assign_in(*root, shift, index, std::move(value));
+    }
+  }
+
+  void pop_in_place() {
+    if (count - tail_offset() > 1) {
+      own<Leaf>(*tail).values.pop_back();
+    } else if (count == 1) {
+      tail.reset();
+    } else {
+      // The tail empties: the last leaf of the tree takes its place.
+      auto last = leaf_at(count - 2);
+      if (remove_last_leaf(*root, shift)) {
+        root.reset();
+      } else if (shift > kBits && branch_of(*root).children.size() == 1) {
+        root = NodeArc(branch_of(*root).children[0]);
+        shift -= kBits;
+      }
+      tail = std::move(last);
+    }
+    --count;
+  }
+
+public:
+  /**
+   * @brief Batch editor, updating a vector in place wherever it can.
+   *
+   * Starts out sharing every node with the vector it came from; each node it
+   * touches is copied once and then edited in place.
+   */
+  class Transient;
+
+  /**
+   * @brief Constructor to create an empty vector, without allocating.
+   */
+  PersistentVector() = default;
+
+  std::size_t size() const { return count; }
+  bool empty() const { return count == 0; }
+
+  /**
+   * @brief Get an element, in O(log32 n).
+   *
+   * @param index Index of the element, less than `size()`.
+   * @return Reference to the element, valid while the vector is unchanged.
+   */
+  const T &operator[](std::size_t index) const {
+    return static_cast<const Leaf *>(leaf_at(index).get())
+        ->values[index & kMask];
+  }
+
+  /**
+   * @brief Get an element, checking the index.
+   *
+   * @param index Index of the element.
+   * @return Reference to the element.
+   * @throws std::out_of_range If the index is not less than `size()`.
+   */
+  const T &at(std::size_t index) const {
+    if (index >= count) {
+      throw std::out_of_range("PersistentVector::at: index out of range");
+    }
+    return (*this)[index];
+  }
+
+  const T &back() const { return (*this)[count - 1]; }
+
+  /**
+   * @brief Call `f` on every element, in order.
+   *
+   * @param f Called as f(element).
+   */
+  template <typename F> void for_each(F &&f) const {
+    for (std::size_t first = 0; first < count; first += kWidth) {
+      for (auto &value :
+           static_cast<const Leaf *>(leaf_at(first).get())->values) {
+        f(value);
+      }
+    }
+  }
+
+  /**
+   * @brief Get a copy with an element appended.
+   *
+   * @param value The element to append.
+   * @return The new vector.
+   */
+  PersistentVector push_back(T value) const & {
+    return PersistentVector(*this).push_back(std::move(value));
+  }
+
+  /**
+   * @brief Append an element to an unshared vector in place.
+   */
+  PersistentVector push_back(T value) && {
+    push_in_place(std::move(value));
+    return std::move(*this);
+  }
+
+  /**
+   * @brief Get a copy with one element replaced.
+   *
+   * @param index Index of the element, less than `size()`.
+   * @param value The new element.
+   * @return The new vector.
+   */
+  PersistentVector set(std::size_t index, T value) const & {
+    return PersistentVector(*this).set(index, std::move(value));
+  }
+
+  /**
+   * @brief Replace an element of an unshared vector in place.
+   */
+  PersistentVector set(std::size_t index, T value) && {
+    set_in_place(index, std::move(value));
+    return std::move(*this);
+  }
+
+  /**
+   * @brief Get a copy without the last element; the vector must not be
+   * empty.
+   *
+   * @return The new vector.
+   */
+  PersistentVector pop_back() const & {
+    return PersistentVector(*this).pop_back();
+  }
+
+  /**
+   * @brief Remove the last element of an unshared vector in place.
+   */
+  PersistentVector pop_back() && {
+    pop_in_place();
+    return std::move(*this);
+  }
+
+  /**
+   * @brief Start a batch of edits.
+   *
+   * @return A Transient sharing this vector's nodes.
+   */
+  Transient transient() const { return Transient(*this); }
+};
+
+template <typename T, typename Count>
+class PersistentVector<T, Count>::Transient {
+private:
+  PersistentVector vector; // The vector being edited
+
+public:
+  explicit Transient(PersistentVector vector) : vector(std::move(vector)) {}
+
+  std::size_t size() const { return vector.size(); }
+  const T &operator[](std::size_t index) const { return vector[index]; }
+
+  Transient &push_back(T value) {
+    vector.push_in_place(std::move(value));
+    return *this;
+  }
+
+  Transient &set(std::size_t index, T value) {
+    vector.set_in_place(index, std::move(value));
+    return *this;
+  }
+
+  Transient &pop_back() {
+    vector.pop_in_place();
+    return *this;
+  }
+
+  /**
+   * @brief Finish editing.
+   *
+   * @return The edited vector.
+   */
+  PersistentVector persistent() && { return std::move(vector); }
+};
+
+/**
+ * @brief PersistentMap class
+ *
+ * Immutable hash map with structural sharing: a hash array mapped trie
+ * (HAMT) of `make_arc` nodes. Each node takes five bits of the hash and
+ * keeps a 32-bit bitmap of the slots in use, with the entries and child
+ * nodes packed after it; keys whose whole hash collides end up together in
+ * a node past the last level. Lookups and updates take O(log32 n) steps, and
+ * an update copies only the nodes on the path to its key, sharing all the
+ * others with the original map.
+ *
+ * As in `PersistentVector`, nodes are copied only while they are shared, so
+ * updating an rvalue or a `Transient` edits in place.
+ *
+ * Every node keeps room for 32 slots inline, for one allocation per node;
+ * sparse maps of large entries trade memory for it.
+ *
+ * @tparam K The key type, which must be copyable.
+ * @tparam V The value type, which must be copyable.
+ * @tparam Hash Default-constructible hash function for K.
+ * @tparam KeyEqual Default-constructible equality for K.
+ * @tparam Count Counting policy of the nodes.
+ */
+template <typename K, typename V, typename Hash = std::hash<K>,
+          typename KeyEqual = std::equal_to<K>, typename Count = AtomicCount>
+class PersistentMap {
+public:
+  using value_type = std::pair<K, V>;
+
+private:
+  static constexpr unsigned kBits = 5; // Hash bits per level
+  static constexpr unsigned kHashBits =
+      std::numeric_limits<std::size_t>::digits;
+
+  struct Node;
+  using NodeArc = Arc<Node, Count>;
+  using Slot = std::variant<value_type, NodeArc>;
+
+  struct Node {
+    std::uint32_t bitmap = 0;                             // Slots in use
+    PersistentChunk<Slot, std::size_t(1) << kBits> slots; // In bit order
+    std::vector<value_type> collisions; // Entries past the last level
+  };
+
+  std::size_t count = 0;       // Number of entries
+  std::optional<NodeArc> root; // Top node, if any entries
+
+  static unsigned popcount(std::uint32_t bits) {
+    bits = bits - ((bits >> 1) & 0x55555555u);
+    bits = (bits & 0x33333333u) + ((bits >> 2) & 0x33333333u);
+    return (((bits + (bits >> 4)) & 0x0f0f0f0fu) * 0x01010101u) >> 24;
+  }
+
+  static std::uint32_t bit_of(std::size_t hash, unsigned shift) {
+    return std::uint32_t(1) << ((hash >> shift) & ((1u << kBits) - 1));
+  }
+
+  static std::size_t index_of(const Node &node, std::uint32_t bit) {
+    return popcount(node.bitmap & (bit - 1));
+  }
+
+  /**
+   * @brief Insert or assign an entry in the subtree of `node`.
+   *
+   * @return True if the key was not there yet.
+   */
+  static bool insert_in(Node &node, unsigned shift, std::size_t hash,
+                        value_type entry) {
+    KeyEqual equal;
+    if (shift >= kHashBits) {
+      for (auto &collision : node.collisions) {
+        if (equal(collision.first, entry.first)) {
+          collision.second = std::move(entry.second);
+          return false;
+        }
+      }
+      node.collisions.push_back(std::move(entry));
+      return true;
+    }
+    auto bit = bit_of(hash, shift);
+    auto index = index_of(node, bit);
+    if (!(node.bitmap & bit)) {
+      node.slots.insert(index, Slot(std::move(entry)));
+      node.bitmap |= bit;
+      return true;
+    }
+    auto &slot = node.slots[index];
+    if (auto child = std::get_if<NodeArc>(&slot)) {
+      return insert_in(child->make_mut(), shift + kBits, hash,
+                       std::move(entry));
+    }
+    auto &existing = std::get<value_type>(slot);
+    if (equal(existing.first, entry.first)) {
+      existing.second = std::move(entry.second);
+      return false;
+    }
+    // Two keys share the slot: push both down into a new node.
+    auto child = make_arc<Node, Count>();
+    auto other = Hash()(existing.first);
+    insert_in(*child.get(), shift + kBits, other, std::move(existing));
+    insert_in(*child.get(), shift + kBits, hash, std::move(entry));
+    slot = std::move(child);
+    return true;
+  }
+
+  /**
+   * @brief Remove a key known to be in the subtree of `node`.
+   */
+  static void erase_in(Node &node, unsigned shift, std::size_t hash,
+                       const K &key) {
+    KeyEqual equal;
+    if (shift >= kHashBits) {
+      auto &collisions = node.collisions;
+      for (std::size_t i = 0; i < collisions.size(); ++i) {
+        if (equal(collisions[i].first, key)) {
+          collisions.erase(collisions.begin() + i);
+          return;
+        }
+      }
+      return;
+    }
+    auto bit = bit_of(hash, shift);
+    auto index = index_of(node, bit);
+    auto &slot = node.slots[index];
+    if (auto child = std::get_if<NodeArc>(&slot)) {
+      auto &inner = child->make_mut();
+      erase_in(inner, shift + kBits, hash, key);
+      // Pull a lone remaining entry up, so that every path stays as short
+      // as the keys it leads to require.
+      value_type *last = nullptr;
+      if (inner.slots.size() == 1 && inner.collisions.empty()) {
+        last = std::get_if<value_type>(&inner.slots[0]);
+      } else if (inner.slots.empty() && inner.collisions.size() == 1) {
+        last = &inner.collisions[0];
+      }
+      if (last) {
+        auto entry = std::move(*last);
+        slot = std::move(entry);
+      }
+      return;
+    }
+    node.slots.erase(index);
+    node.bitmap &= ~bit;
+  }
+
+  template <typename F> static void for_each_in(const Node &node, F &f) {
+    for (auto &slot : node.slots) {
+      if (auto entry = std::get_if<value_type>(&slot)) {
+        f(entry->first, entry->second);
+      } else {
+        for_each_in(*std::get<NodeArc>(slot).get(), f);
+      }
+    }
+    for (auto &entry : node.collisions) {
+      f(entry.first, entry.second);
+    }
+  }
+
+  void insert_in_place(K key, V value) {
+    if (!root) {
+      root = make_arc<Node, Count>();
+    }
+    auto hash = Hash()(key);
+    if (insert_in(root->make_mut(), 0, hash,
+                  value_type(std::move(key), std::move(value)))) {
+      ++count;
+    }
+  }
+
+  void erase_in_place(const K &key) {
+    if (!find(key)) {
+      return;
+    }
+    if (count == 1) {
+      root.reset();
+    } else {
+      // Counted only once the nodes on the path are copied, since a copy
+      // of an entry may throw.
+      erase_in(root->make_mut(), 0, Hash()(key), key);
+    }
+    --count;
+  }
+
+public:
+  /**
+   * @brief Batch editor, updating a map in place wherever it can.
+   *
+   * Starts out sharing every node with the map it came from; each node it
+   * touches is copied once and then edited in place.
+   */
+  class Transient;
+
+  /**
+   * @brief Constructor to create an empty map, without allocating.
+   */
+  PersistentMap() = default;
+
+  std::size_t size() const { return count; }
+  bool empty() const { return count == 0; }
+
+  /**
+   * @brief Look a key up, in O(log32 n).
+   *
+   * @param key The key to look for.
+   * @return Pointer to its value, valid while the map is unchanged, or
+   * nullptr if the key is not in the map.
+   */
+  const V *find(const K &key) const {
+    if (!root) {
+      return nullptr;
+    }
+    KeyEqual equal;
+    auto hash = Hash()(key);
+    auto node = root->get();
+    for (unsigned shift = 0; shift < kHashBits; shift += kBits) {
+      auto bit = bit_of(hash, shift);
+      if (!(node->bitmap & bit)) {
+        return nullptr;
+      }
+      auto &slot = node->slots[index_of(*node, bit)];
+      if (auto entry = std::get_if<value_type>(&slot)) {
+        return equal(entry->first, key) ? &entry->second : nullptr;
+      }
+      node = std::get<NodeArc>(slot).get();
+    }
+    for (auto &entry : node->collisions) {
+      if (equal(entry.first, key)) {
+        return &entry.second;
+      }
+    }
+    return nullptr;
+  }
+
+  bool contains(const K &key) const { return find(key) != nullptr; }
+
+  /**
+   * @brief Get the value of a key that must be in the map.
+   *
+   * @param key The key to look for.
+   * @return Reference to its value.
+   * @throws std::out_of_range If the key is not in the map.
+   */
+  const V &at(const K &key) const {
+    if (auto value = find(key)) {
+      return *value;
+    }
+    throw std::out_of_range("PersistentMap::at: key not found");
+  }
+
+  /**
+   * @brief Call `f` on every entry, in no particular order.
+   *
+   * @param f Called as f(key, value).
+   */
+  template <typename F> void for_each(F &&f) const {
+    if (root) {
+      for_each_in(*root->get(), f);
+    }
+  }
+
+  /**
+   * @brief Get a copy with a key set to a value, inserted or replaced.
+   *
+   * @param key The key.
+   * @param value Its new value.
+   * @return The new map.
+   */
+  PersistentMap set(K key, V value) const & {
+    return PersistentMap(*this).set(std::move(key), std::move(value));
+  }
+
+  /**
+   * @brief Set a key of an unshared map in place.
+   */
+  PersistentMap set(K key, V value) && {
+    insert_in_place(std::move(key), std::move(value));
+    return std::move(*this);
+  }
+
+  /**
+   * @brief Get a copy without a key; the map itself if it has no such key.
+   *
+   * @param key The key to remove.
+   * @return The new map.
+   */
+  PersistentMap erase(const K &key) const & {
+    return PersistentMap(*this).erase(key);
+  }
+
+  /**
+   * @brief Remove a key from an unshared map in place.
+   */
+  PersistentMap erase(const K &key) && {
+    erase_in_place(key);
+    return std::move(*this);
+  }
+
+  /**
+   * @brief Start a batch of edits.
+   *
+   * @return A Transient sharing this map's nodes.
+   */
+  Transient transient() const { return Transient(*this); }
+};
+
+template <typename K, typename V, typename Hash, typename KeyEqual,
+          typename Count>
+class PersistentMap<K, V, Hash, KeyEqual, Count>::Transient {
+private:
+  PersistentMap map; // The map being edited
+
+public:
+  explicit Transient(PersistentMap map) : map(std::move(map)) {}
+
+  std::size_t size() const { return map.size(); }
+  const V *find(const K &key) const { return map.find(key); }
+
+  Transient &set(K key, V value) {
+    map.insert_in_place(std::move(key), std::move(value));
+    return *this;
+  }
+
+  Transient &erase(const K &key) {
+    map.erase_in_place(key);
+    return *this;
+  }
+
+  /**
+   * @brief Finish editing.
+   *
+   * @return The edited map.
+   */
+  PersistentMap persistent() && { return std::move(map); }
+};
+
+
+template <typename T> class IntrusiveArc;
+
+/**
+ * @brief ArcBase class
+ *
+ * Mixin for types that carry their own reference count, for use with
+ * `IntrusiveArc`. Derive as `struct Node : ArcBase<Node> { ... };`. The
+ * count comes from the same counting policy as Arc's control blocks, so
+ * copies and releases behave and order memory exactly as Arc's do.
+ *
+ * A new object starts with one reference, which the first IntrusiveArc
+ * adopts. Copying or assigning an object does not copy its count.
+ *
+ * @tparam T The derived type, deleted when the count reaches zero.
+ * @tparam Count Counting policy providing the reference count.
+ */
+template <typename T, typename Count = AtomicCount> class ArcBase {
+private:
+  static_assert(!std::is_same_v<Count, BiasedCount>,
+                "BiasedCount needs a control block to merge into");
+
+  mutable Count counts; // Reference count of the object
+
+  template <typename U> friend class IntrusiveArc;
+
+protected:
+  ArcBase() = default;
+  ArcBase(const ArcBase &) {}
+  ArcBase &operator=(const ArcBase &) { return *this; }
+  ~ArcBase() = default;
+
+public:
+  /**
+   * @brief Get a new IntrusiveArc sharing this object.
+   *
+   * The object must already be owned by an IntrusiveArc.
+   *
+   * @return IntrusiveArc holding a new reference to this object.
+   */
+  IntrusiveArc<T> arc_from_this() const;
+};
+
+/**
+ * @brief IntrusiveArc class
+ *
+ * Reference-counted pointer to an object that derives from `ArcBase` and
+ * holds its own count. There is no control block, so an IntrusiveArc is one
+ * pointer and reaching the object takes no extra indirection. The object is
+ * deleted as a T when the last reference goes, so a T used through a base
+ * class needs a virtual destructor. There are no weak references: the count
+ * ends with the object.
+ *
+ * @tparam T The type of the object being managed.
+ */
+template <typename T> class IntrusiveArc {
+private:
+  T *ptr; // Pointer to data
+
+  void release() {
+    if (ptr && ptr->counts.decrement()) {
+      delete ptr;
+    }
+  }
+
+public:
+  /**
+   * @brief Constructor to create an empty IntrusiveArc instance.
+   */
+  IntrusiveArc() : ptr(nullptr) {}
+
+  /**
+   * @brief Constructor to adopt a newly allocated object.
+   *
+   * Takes over the reference the object was created with; use
+   * `arc_from_this` to share an object that is already owned.
+   *
+   * @param ptr Pointer to an object allocated with `new`.
+   */
+  explicit IntrusiveArc(T *ptr) : ptr(ptr) {}
+
+  /**
+   * @brief Copy constructor.
+   *
+   * @param other The IntrusiveArc instance to copy from.
+   */
+  IntrusiveArc(const IntrusiveArc &other) : ptr(other.ptr) {
+    if (ptr) {
+      ptr->counts.increment();
+    }
+  }
+
+  /**
+   * @brief Move constructor.
+   *
+   * @param other The IntrusiveArc instance to move from.
+   */
+  IntrusiveArc(IntrusiveArc &&other) noexcept : ptr(other.ptr) {
+    other.ptr = nullptr;
+  }
+
+  /**
+   * @brief Assignment operator.
+   *
+   * The old object is released last, so it may own `other`.
+   *
+   * @param other The IntrusiveArc instance to assign.
+   * @return Reference to the assigned IntrusiveArc instance.
+   */
+  IntrusiveArc &operator=(const IntrusiveArc &other) {
+    IntrusiveArc copy(other);
+    std::swap(ptr, copy.ptr);
+    return *this;
+  }
+
+  /**
+   * @brief Move assignment operator.
+   *
+   * The old object is released last, so it may own `other`, as in the list
+   * walk `node = std::move(node->next)`.
+   *
+   * @param other The IntrusiveArc instance to move from.
+   * @return Reference to the assigned IntrusiveArc instance.
+   */
+  IntrusiveArc &operator=(IntrusiveArc &&other) noexcept {
+    if (this != &other) {
+      IntrusiveArc moved(std::move(other));
+      std::swap(ptr, moved.ptr);
+    }
+    return *this;
+  }
+
+  /**
+   * @brief Destructor.
+   *
+   * Deletes the object if this was its last reference.
+   */
+  ~IntrusiveArc() { release(); }
+
+  /**
+   * @brief Get the raw pointer to the managed object.
+   *
+   * @return Pointer to the managed object.
+   */
+  T *get() const { return ptr; }
+
+  /**
+   * @brief Clone the IntrusiveArc instance.
+   *
+   * @return A new IntrusiveArc instance sharing the same object.
+   */
+  IntrusiveArc clone() const { return IntrusiveArc(*this); }
+};
+
+template <typename T, typename Count>
+IntrusiveArc<T> ArcBase<T, Count>::arc_from_this() const {
+  counts.increment();
+  return IntrusiveArc<T>(static_cast<T *>(const_cast<ArcBase *>(this)));
+}
+
+/**
+ * @brief Create an IntrusiveArc instance managing a new object.
+ *
+ * @tparam T Type of the object, deriving from `ArcBase<T>`.
+ * @param args Arguments forwarded to the constructor of T.
+ * @return IntrusiveArc instance managing the new object.
+ */
+template <typename T, typename... Args>
+IntrusiveArc<T> make_intrusive_arc(Args &&...args) {
+  return IntrusiveArc<T>(new T(std::forward<Args>(args)...));
+}
+
 #endif
\ No newline at end of file
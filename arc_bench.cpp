@@ -0,0 +1,363 @@
+#include "arc.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+
+#ifdef ARC_BENCH_HAVE_BOOST
+#include <boost/smart_ptr/intrusive_ptr.hpp>
+#include <boost/smart_ptr/intrusive_ref_counter.hpp>
+#endif
+
+/**
+ * @brief Arc benchmark suite
+ *
+ * Compares Arc against std::shared_ptr (and boost::intrusive_ptr when Boost is
+ * available) on the operations that dominate refcounting workloads:
+ * construction, destruction, copy, move, clone and weak upgrade. Each
+ * benchmark runs at 1 to N threads, either on one object shared by all
+ * threads or on one independent object per thread, and reports nanoseconds
+ * and heap allocations per operation.
+ *
+ * Usage: arc_bench [max_threads] [iterations_per_thread]
+ */
+
+// Allocation counting. Every thread tallies its own allocations so that the
+// counter itself does not become a shared cache line.
+static thread_local std::size_t thread_allocations = 0;
+
+void *operator new(std::size_t size) {
+  ++thread_allocations;
+  if (auto ptr = std::malloc(size ? size : 1)) {
+    return ptr;
+  }
+  throw std::bad_alloc();
+}
+
+void *operator new(std::size_t size, std::align_val_t alignment) {
+  ++thread_allocations;
+  auto align = static_cast<std::size_t>(alignment);
+  if (auto ptr = std::aligned_alloc(align, (size + align - 1) / align * align)) {
+    return ptr;
+  }
+  throw std::bad_alloc();
+}
+
+void operator delete(void *ptr) noexcept { std::free(ptr); }
+void operator delete(void *ptr, std::size_t) noexcept { std::free(ptr); }
+void operator delete(void *ptr, std::align_val_t) noexcept { std::free(ptr); }
+void operator delete(void *ptr, std::size_t, std::align_val_t) noexcept {
+  std::free(ptr);
+}
+
+/**
+ * @brief Keep the compiler from optimizing a value away.
+ */
+template <typename T> inline void do_not_optimize(T const &value) {
+#if defined(__GNUC__)
+  asm volatile("" : : "r,m"(value) : "memory");
+#else
+  static volatile const void *sink;
+  sink = &value;
+#endif
+}
+
+struct Payload {
+  long value;
+
+  explicit Payload(long value) : value(value) {}
+};
+
+// Each implementation provides the same small set of operations, so that the
+// benchmarks are written once.
+
+struct ArcImpl {
+  static constexpr const char *name = "Arc";
+  static constexpr bool has_weak = true;
+  using Strong = Arc<Payload>;
+  using Weak = WeakArc<Payload>;
+
+  static Strong make(long value) { return make_arc<Payload>(value); }
+  static Strong clone(const Strong &strong) { return strong.clone(); }
+  static Weak downgrade(Strong &strong) { return Weak(strong); }
+  static Strong upgrade(const Weak &weak) { return weak.upgrade(); }
+};
+
+struct BiasedArcImpl {
+  static constexpr const char *name = "Arc/biased";
+  static constexpr bool has_weak = true;
+  using Strong = Arc<Payload, BiasedCount>;
+  using Weak = WeakArc<Payload, BiasedCount>;
+
+  static Strong make(long value) {
+    return make_arc<Payload, BiasedCount>(value);
+  }
+  static Strong clone(const Strong &strong) { return strong.clone(); }
+  static Weak downgrade(Strong &strong) { return Weak(strong); }
+  static Strong upgrade(const Weak &weak) { return weak.upgrade(); }
+};
+
+struct ShardedArcImpl {
+  static constexpr const char *name = "ShardedArc";
+  static constexpr bool has_weak = false;
+  using Strong = ShardedArc<Payload>;
+  using Weak = Strong;
+
+  static Strong make(long value) { return make_sharded_arc<Payload>(value); }
+  static Strong clone(const Strong &strong) { return strong.clone(); }
+  static Weak downgrade(Strong &strong) { return strong; }
+  static Strong upgrade(const Weak &weak) { return weak; }
+};
+
+struct IntrusiveArcPayload : ArcBase<IntrusiveArcPayload> {
+  long value;
+
+  explicit IntrusiveArcPayload(long value) : value(value) {}
+};
+
+struct IntrusiveArcImpl {
+  static constexpr const char *name = "IntrusiveArc";
+  static constexpr bool has_weak = false;
+  using Strong = IntrusiveArc<IntrusiveArcPayload>;
+  using Weak = Strong;
+
+  static Strong make(long value) {
+    return make_intrusive_arc<IntrusiveArcPayload>(value);
+  }
+  static Strong clone(const Strong &strong) { return strong.clone(); }
+  static Weak downgrade(Strong &strong) { return strong; }
+  static Strong upgrade(const Weak &weak) { return weak; }
+};
+
+struct SharedPtrImpl {
+  static constexpr const char *name = "shared_ptr";
+  static constexpr bool has_weak = true;
+  using Strong = std::shared_ptr<Payload>;
+  using Weak = std::weak_ptr<Payload>;
+
+  static Strong make(long value) { return std::make_shared<Payload>(value); }
+  static Strong clone(const Strong &strong) { return strong; }
+  static Weak downgrade(Strong &strong) { return Weak(strong); }
+  static Strong upgrade(const Weak &weak) { return weak.lock(); }
+};
+
+#ifdef ARC_BENCH_HAVE_BOOST
+struct IntrusivePayload
+    : boost::intrusive_ref_counter<IntrusivePayload,
+                                   boost::thread_safe_counter> {
+  long value;
+
+  explicit IntrusivePayload(long value) : value(value) {}
+};
+
+struct IntrusivePtrImpl {
+  static constexpr const char *name = "intrusive_ptr";
+  static constexpr bool has_weak = false;
+  using Strong = boost::intrusive_ptr<IntrusivePayload>;
+  using Weak = Strong;
+
+  static Strong make(long value) { return Strong(new IntrusivePayload(value)); }
+  static Strong clone(const Strong &strong) { return strong; }
+  static Weak downgrade(Strong &strong) { return strong; }
+  static Strong upgrade(const Weak &weak) { return weak; }
+};
+#endif
+
+/**
+ * @brief Result of one benchmark run.
+ */
+struct Result {
+  double ns_per_op;     // Wall time per operation, per thread
+  double allocs_per_op; // Heap allocations per operation
+};
+
+/**
+ * @brief Run `body` on `threads` threads, released together, and time it.
+ *
+ * @param threads Number of threads.
+ * @param iterations Operations performed by each thread.
+ * @param body Called as body(thread_index, iterations) on each thread.
+ * @return Time and allocations per operation.
+ */
+Result run_threads(int threads, long iterations,
+                   const std::function<void(int, long)> &body) {
+  std::atomic<int> ready(0);
+  std::atomic<bool> go(false);
+  std::atomic<std::size_t> allocations(0);
+  std::atomic<long long> elapsed_ns(0);
+
+  std::vector<std::thread> workers;
+  for (int t = 0; t < threads; ++t) {
+    workers.emplace_back([&, t]() {
+      ready.fetch_add(1);
+      while (!go.load(std::memory_order_acquire)) {
+        std::this_thread::yield();
+      }
+      auto before = thread_allocations;
+      auto start = std::chrono::steady_clock::now();
+      body(t, iterations);
+      auto stop = std::chrono::steady_clock::now();
+      allocations.fetch_add(thread_allocations - before);
+      elapsed_ns.fetch_add(
+          std::chrono::duration_cast<std::chrono::nanoseconds>(stop - start)
+              .count());
+    });
+  }
+  while (ready.load() != threads) {
+    std::this_thread::yield();
+  }
+  go.store(true, std::memory_order_release);
+  for (auto &worker : workers) {
+    worker.join();
+  }
+
+  auto ops = static_cast<double>(iterations) * threads;
+  return Result{static_cast<double>(elapsed_ns.load()) / ops,
+                static_cast<double>(allocations.load()) / ops};
+}
+
+/**
+ * @brief Benchmarks for one implementation at one thread count.
+ *
+ * In shared mode every thread works on the same object; in independent mode
+ * each thread has its own.
+ */
+template <typename Impl> class Suite {
+private:
+  using Strong = typename Impl::Strong;
+  using Weak = typename Impl::Weak;
+
+  int threads;
+  long iterations;
+  bool shared;
+  Strong object; // The object all threads share, in shared mode
+
+  // The object a thread works on. In independent mode it is made on the
+  // thread itself, so that policies biased towards the creating thread are
+  // measured the way they are used.
+  Strong source(int thread) {
+    return shared ? object : Impl::make(thread);
+  }
+
+  void report(const char *benchmark, Result result) {
+    std::printf("%-10s %-14s %-12s %7d %10.2f %10.3f\n", benchmark, Impl::name,
+                shared ? "shared" : "independent", threads, result.ns_per_op,
+                result.allocs_per_op);
+  }
+
+public:
+  Suite(int threads, long iterations, bool shared)
+      : threads(threads), iterations(iterations), shared(shared),
+        object(Impl::make(0)) {}
+
+  void run() {
+    // Construction and destruction are per-thread by nature, so they only
+    // run once, in independent mode.
+    if (!shared) {
+      constexpr long kBatch = 1024;
+      std::vector<std::vector<Strong>> batches(threads);
+      for (auto &batch : batches) {
+        batch.reserve(kBatch);
+      }
+      std::vector<long long> drop_ns(threads, 0);
+      auto make = run_threads(threads, iterations, [&](int t, long n) {
+        auto &batch = batches[t];
+        long long dropping = 0;
+        for (long i = 0; i < n; i += kBatch) {
+          auto count = std::min(kBatch, n - i);
+          for (long j = 0; j < count; ++j) {
+            batch.push_back(Impl::make(j));
+          }
+          auto start = std::chrono::steady_clock::now();
+          batch.clear();
+          dropping += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                          std::chrono::steady_clock::now() - start)
+                          .count();
+        }
+        drop_ns[t] = dropping;
+      });
+      long long total_drop = 0;
+      for (auto ns : drop_ns) {
+        total_drop += ns;
+      }
+      auto ops = static_cast<double>(iterations) * threads;
+      Result drop{total_drop / ops, 0};
+      make.ns_per_op -= drop.ns_per_op;
+      report("make", make);
+      report("drop", drop);
+    }
+
+    report("copy", run_threads(threads, iterations, [&](int t, long n) {
+             auto original = source(t);
+             for (long i = 0; i < n; ++i) {
+               Strong copy(original);
+               do_not_optimize(copy);
+             }
+           }));
+
+    report("clone", run_threads(threads, iterations, [&](int t, long n) {
+             auto original = source(t);
+             for (long i = 0; i < n; ++i) {
+               auto copy = Impl::clone(original);
+               do_not_optimize(copy);
+             }
+           }));
+
+    report("move", run_threads(threads, iterations, [&](int t, long n) {
+             Strong first(source(t));
+             Strong second(Impl::make(0));
+             for (long i = 0; i < n; ++i) {
+               second = std::move(first);
+               first = std::move(second);
+               do_not_optimize(first);
+             }
+           }));
+
+    if (Impl::has_weak) {
+      report("upgrade", run_threads(threads, iterations, [&](int t, long n) {
+               auto original = source(t);
+               auto weak = Impl::downgrade(original);
+               for (long i = 0; i < n; ++i) {
+                 auto strong = Impl::upgrade(weak);
+                 do_not_optimize(strong);
+               }
+             }));
+    }
+  }
+};
+
+template <typename Impl> void run_impl(int threads, long iterations) {
+  Suite<Impl>(threads, iterations, false).run();
+  Suite<Impl>(threads, iterations, true).run();
+}
+
+int main(int argc, char **argv) {
+  int max_threads = static_cast<int>(std::thread::hardware_concurrency());
+  long iterations = 1000000;
+  if (argc > 1) {
+    max_threads = std::atoi(argv[1]);
+  }
+  if (argc > 2) {
+    iterations = std::atol(argv[2]);
+  }
+  max_threads = std::max(max_threads, 1);
+
+  std::printf("%-10s %-14s %-12s %7s %10s %10s\n", "benchmark", "impl", "mode",
+              "threads", "ns/op", "allocs/op");
+  for (int threads = 1;; threads = std::min(threads * 2, max_threads)) {
+    run_impl<ArcImpl>(threads, iterations);
+    run_impl<BiasedArcImpl>(threads, iterations);
+    run_impl<ShardedArcImpl>(threads, iterations);
+    run_impl<IntrusiveArcImpl>(threads, iterations);
+    run_impl<SharedPtrImpl>(threads, iterations);
+#ifdef ARC_BENCH_HAVE_BOOST
+    run_impl<IntrusivePtrImpl>(threads, iterations);
+#endif
+    if (threads == max_threads) {
+      break;
+    }
+  }
+  return 0;
+}
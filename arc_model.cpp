@@ -0,0 +1,290 @@
+#include <relacy/relacy.hpp>
+
+#include <cstdlib>
+
+/**
+ * @brief Model check of the Arc reference counting protocol
+ *
+ * Runs the strong and weak count protocol of `BasicAtomicCount` and
+ * `ArcControlBlockBase` under Relacy Race Detector, which explores thread
+ * interleavings and the weak behaviours the C++ memory model allows for each
+ * memory ordering. The object and the block are `rl::var`s, so an access
+ * that is not ordered after the last write of another thread, or after the
+ * object is destroyed, is reported as a race.
+ *
+ * Relacy needs every atomic access annotated, so the protocol is restated
+ * here rather than included from arc.h. Keep the orderings in step with
+ * `BasicAtomicCount`: a change to one of them should be made here first.
+ *
+ * Built by the `arc_model` target when `ARC_RELACY_DIR` points to a Relacy
+ * checkout. It has not yet been run against Relacy itself, so treat it as
+ * unverified until it has. Usage: arc_model [iterations]
+ */
+
+/**
+ * @brief One control block: the counts, the object and what happened to
+ * them.
+ */
+struct Block {
+  static constexpr int kWeakLocked = -1; // Weak count held by is_unique
+
+  rl::atomic<int> strong; // Strong reference count
+  rl::atomic<int> weak;   // Weak references, plus one for all strong
+  rl::var<int> value;     // The object
+  rl::var<int> destroyed; // Times the object was destroyed
+  rl::var<int> freed;     // Times the block was freed
+
+  void init(int strong_count, int weak_count) {
+    strong($).store(strong_count, rl::mo_relaxed);
+    weak($).store(weak_count, rl::mo_relaxed);
+    value($) = 0;
+    destroyed($) = 0;
+    freed($) = 0;
+  }
+
+  // As in BasicAtomicCount.
+
+  void increment() { strong($).fetch_add(1, rl::mo_relaxed); }
+
+  bool decrement() {
+    if (strong($).fetch_sub(1, rl::mo_release) == 1) {
+      rl::atomic_thread_fence(rl::mo_acquire, $);
+      return true;
+    }
+    return false;
+  }
+
+  bool try_increment() {
+    auto count = strong($).load(rl::mo_relaxed);
+    while (count != 0) {
+      if (strong($).compare_exchange_weak(count, count + 1, rl::mo_acquire,
+                                          rl::mo_relaxed)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void increment_weak() {
+    auto count = weak($).load(rl::mo_relaxed);
+    do {
+      while (count == kWeakLocked) {
+        rl::yield(1, $);
+        count = weak($).load(rl::mo_relaxed);
+      }
+    } while (!weak($).compare_exchange_weak(count, count + 1, rl::mo_acquire,
+                                            rl::mo_relaxed));
+  }
+
+  bool decrement_weak() {
+    if (weak($).load(rl::mo_acquire) == 1) {
+      return true;
+    }
+    if (weak($).fetch_sub(1, rl::mo_release) == 1) {
+      rl::atomic_thread_fence(rl::mo_acquire, $);
+      return true;
+    }
+    return false;
+  }
+
+  bool is_unique() {
+    int expected = 1;
+    if (!weak($).compare_exchange_strong(expected, kWeakLocked,
+                                         rl::mo_acquire, rl::mo_relaxed)) {
+      return false;
+    }
+    bool unique = strong($).load(rl::mo_acquire) == 1;
+    weak($).store(1, rl::mo_release);
+    return unique;
+  }
+
+  // As in ArcControlBlockBase.
+
+  void release_weak() {
+    if (decrement_weak()) {
+      RL_ASSERT(destroyed($) == 1);
+      freed($) = freed($) + 1;
+    }
+  }
+
+  void release() {
+    if (decrement()) {
+      RL_ASSERT(freed($) == 0);
+      value($) = -1; // The destructor writes the object
+      destroyed($) = destroyed($) + 1;
+      release_weak(); // The weak reference all strong ones hold together
+    }
+  }
+
+  /**
+   * @brief Read the object through a reference the caller owns.
+   */
+  void use() {
+    RL_ASSERT(destroyed($) == 0);
+    int observed = value($);
+    (void)observed;
+  }
+
+  /**
+   * @brief Write the object, which only a unique owner may do.
+   */
+  void mutate() {
+    RL_ASSERT(destroyed($) == 0);
+    value($) = 1;
+  }
+
+  void check_done() {
+    RL_ASSERT(destroyed($) == 1);
+    RL_ASSERT(freed($) == 1);
+  }
+};
+
+/**
+ * @brief Two owners read the object and drop their references. The
+ * destructor, run by the last drop, must be ordered after both reads, and
+ * everything is freed once.
+ */
+struct DropDrop : rl::test_suite<DropDrop, 2> {
+  Block block;
+
+  void before() { block.init(2, 1); }
+
+  void thread(unsigned) {
+    block.use();
+    block.release();
+  }
+
+  void after() { block.check_done(); }
+};
+
+/**
+ * @brief A WeakArc is upgraded while the last strong reference is dropped.
+ * An upgrade must never revive a destroyed object.
+ */
+struct UpgradeDrop : rl::test_suite<UpgradeDrop, 2> {
+  Block block;
+
+  void before() { block.init(1, 2); }
+
+  void thread(unsigned index) {
+    if (index == 0) {
+      block.use();
+      block.release();
+    } else {
+      if (block.try_increment()) {
+        block.use();
+        block.release();
+      }
+      block.release_weak();
+    }
+  }
+
+  void after() { block.check_done(); }
+};
+
+/**
+ * @brief One owner writes through `get_mut_if_unique` while another thread
+ * clones from a weak reference and drops both. A unique owner must exclude
+ * every other access.
+ */
+struct UniqueUpgrade : rl::test_suite<UniqueUpgrade, 2> {
+  Block block;
+
+  void before() { block.init(1, 2); }
+
+  void thread(unsigned index) {
+    if (index == 0) {
+      if (block.is_unique()) {
+        block.mutate();
+      }
+      block.release();
+    } else {
+      if (block.try_increment()) {
+        block.use();
+        block.release();
+      }
+      block.release_weak();
+    }
+  }
+
+  void after() { block.check_done(); }
+};
+
+/**
+ * @brief One owner writes through `get_mut_if_unique` while the other
+ * downgrades, drops its strong reference and upgrades again. Two plain loads
+ * in `is_unique` would miss the second owner in both counts; the weak count
+ * lock must not.
+ */
+struct DowngradeUnique : rl::test_suite<DowngradeUnique, 2> {
+  Block block;
+
+  void before() { block.init(2, 1); }
+
+  void thread(unsigned index) {
+    if (index == 0) {
+      if (block.is_unique()) {
+        block.mutate();
+      }
+      block.release();
+    } else {
+      block.increment_weak();
+      block.release();
+      if (block.try_increment()) {
+        block.use();
+        block.release();
+      }
+      block.release_weak();
+    }
+  }
+
+  void after() { block.check_done(); }
+};
+
+/**
+ * @brief Clones and weak references are taken and dropped from three
+ * threads at once, starting from one owner each.
+ */
+struct CloneDowngrade : rl::test_suite<CloneDowngrade, 3> {
+  Block block;
+
+  void before() { block.init(3, 1); }
+
+  void thread(unsigned index) {
+    block.use();
+    switch (index) {
+    case 0: // Clones, then drops both references
+      block.increment();
+      block.release();
+      block.release();
+      break;
+    case 1: // Downgrades, drops, then upgrades again if it still can
+      block.increment_weak();
+      block.release();
+      if (block.try_increment()) {
+        block.use();
+        block.release();
+      }
+      block.release_weak();
+      break;
+    default: // Downgrades and drops both references
+      block.increment_weak();
+      block.release();
+      block.release_weak();
+      break;
+    }
+  }
+
+  void after() { block.check_done(); }
+};
+
+int main(int argc, char **argv) {
+  rl::test_params params;
+  params.iteration_count = argc > 1 ? std::atoi(argv[1]) : 1000000;
+  bool passed = rl::simulate<DropDrop>(params) &&
+                rl::simulate<UpgradeDrop>(params) &&
+                rl::simulate<UniqueUpgrade>(params) &&
+                rl::simulate<DowngradeUnique>(params) &&
+                rl::simulate<CloneDowngrade>(params);
+  return passed ? 0 : 1;
+}
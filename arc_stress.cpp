@@ -0,0 +1,1157 @@
+#include "arc.h"
+
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <optional>
+
+/**
+ * @brief Arc concurrency stress test
+ *
+ * Hammers Arc and WeakArc from many threads with a randomized mix of clone,
+ * copy and move assignment, drop, downgrade, upgrade and weak assignment.
+ * Handles travel between threads through shared AtomicArc slots and an
+ * ArcQueue, so objects are created, shared, upgraded and destroyed on
+ * different threads in an order no two runs repeat.
+ *
+ * Every object carries a canary that its destructor clears, and every access
+ * checks it, so a use after free or a double free is reported even without a
+ * sanitizer. Control blocks come from a counting allocator, so a leaked
+ * strong or weak reference shows up as a block that is never freed. Build
+ * with `-DARC_SANITIZER=thread` to have TSan check the memory orderings as
+ * well.
+ *
+ * The mixed run is repeated with `BiasedCount` and `PackedAtomicCount`
+ * handles, and pairs of threads pass biased handles back and forth so that
+ * owners merge their counts while their peers drop clones. Then the other
+ * lock-free paths each get a phase: threads clone and drop `ShardedArc`
+ * handles, borrow from AtomicArc slots that others replace, push and pop on
+ * an ArcStack and a BoundedArcQueue, drop objects onto the `ArcReclaimer`
+ * thread, and allocate or free pooled blocks that travel through
+ * `ArcPool`'s global stack.
+ *
+ * After that, each operation runs on its own on every thread, and its
+ * throughput is reported in nanoseconds per operation. Every thread then
+ * drops a deep `ArcIterativeDestruction` list whole and pops another one
+ * node at a time by move assignment. Last, every thread checks the
+ * persistent containers against std::vector and std::map.
+ *
+ * Usage: arc_stress [threads] [iterations_per_thread] [seed]
+ */
+
+static std::atomic<long> live_objects(0); // Objects not destroyed yet
+static std::atomic<long> live_blocks(0);  // Control blocks not freed yet
+static std::atomic<long> failures(0);     // Failed checks
+
+static void fail(const char *what) {
+  if (failures.fetch_add(1) < 16) {
+    std::fprintf(stderr, "arc_stress: %s\n", what);
+  }
+}
+
+/**
+ * @brief Object under test, which checks that it is only used while alive.
+ */
+struct Tracked {
+  static constexpr std::uint64_t kAlive = 0xA11CE0FA11CE0FAull;
+  static constexpr std::uint64_t kDead = 0xDEADDEADDEADDEADull;
+
+  std::atomic<std::uint64_t> canary; // kAlive until destroyed
+  long value;                        // Written only by a unique owner
+
+  explicit Tracked(long value) : canary(kAlive), value(value) {
+    live_objects.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  ~Tracked() {
+    if (canary.exchange(kDead, std::memory_order_relaxed) != kAlive) {
+      fail("object destroyed twice");
+    }
+    live_objects.fetch_sub(1, std::memory_order_relaxed);
+  }
+
+  void check() const {
+    if (canary.load(std::memory_order_relaxed) != kAlive) {
+      fail("object used after it was destroyed");
+    }
+  }
+};
+
+/**
+ * @brief Std-style allocator that counts the control blocks it hands out.
+ */
+template <typename T> struct CountingAllocator {
+  using value_type = T;
+
+  CountingAllocator() = default;
+  template <typename U> CountingAllocator(const CountingAllocator<U> &) {}
+
+  T *allocate(std::size_t n) {
+    live_blocks.fetch_add(1, std::memory_order_relaxed);
+    return std::allocator<T>().allocate(n);
+  }
+
+  void deallocate(T *ptr, std::size_t n) {
+    live_blocks.fetch_sub(1, std::memory_order_relaxed);
+    std::allocator<T>().deallocate(ptr, n);
+  }
+
+  template <typename U> bool operator==(const CountingAllocator<U> &) const {
+    return true;
+  }
+  template <typename U> bool operator!=(const CountingAllocator<U> &) const {
+    return false;
+  }
+};
+
+template <typename Count = AtomicCount>
+static Arc<Tracked, Count> make(long value) {
+  return allocate_arc<Tracked, Count>(CountingAllocator<Tracked>(), value);
+}
+
+/**
+ * @brief Node of a singly linked list, destroyed through `ArcDropList`.
+ */
+struct ListNode {
+  Tracked item;
+  std::optional<Arc<ListNode>> next;
+
+  ListNode(long value, std::optional<Arc<ListNode>> next)
+      : item(value), next(std::move(next)) {}
+};
+
+template <> struct ArcIterativeDestruction<ListNode> : std::true_type {};
+
+/**
+ * @brief Build a list of `length` nodes, far deeper than recursive
+ * destruction could handle.
+ */
+static Arc<ListNode> make_list(long length) {
+  std::optional<Arc<ListNode>> head;
+  for (long i = 0; i < length; ++i) {
+    head = allocate_arc<ListNode>(CountingAllocator<ListNode>(), i,
+                                  std::move(head));
+  }
+  return std::move(*head);
+}
+
+/**
+ * @brief Object destroyed on the `ArcReclaimer` thread.
+ */
+struct Deferred : Tracked {
+  using Tracked::Tracked;
+};
+
+template <> struct ArcDeferredDestruction<Deferred> : std::true_type {};
+
+/**
+ * @brief Object that readers borrow through `AtomicArc::borrow`.
+ */
+struct Borrowed : Tracked {
+  using Tracked::Tracked;
+};
+
+template <> struct ArcEpochDestruction<Borrowed> : std::true_type {};
+
+/**
+ * @brief xorshift64* generator, one per thread, seeded from the run seed.
+ */
+class Random {
+private:
+  std::uint64_t state;
+
+public:
+  explicit Random(std::uint64_t seed) : state(seed * 2654435761u + 1) {}
+
+  std::uint64_t next() {
+    state ^= state >> 12;
+    state ^= state << 25;
+    state ^= state >> 27;
+    return state * 2685821657736338717ull;
+  }
+
+  std::size_t below(std::size_t bound) { return next() % bound; }
+};
+
+enum Operation {
+  kMake,       // Replace a local handle with a new object
+  kClone,      // Clone one local handle into another
+  kCopyAssign, // Copy-assign one local handle to another
+  kMoveAssign, // Move-assign one local handle to another
+  kDrop,       // Drop a local handle
+  kDowngrade,  // Take a weak reference from a local handle
+  kUpgrade,    // upgrade() a local weak reference
+  kTryUpgrade, // try_upgrade() a local weak reference
+  kWeakAssign, // Copy-assign one local weak reference to another
+  kLoad,       // Load a shared slot
+  kStore,      // Store a local handle into a shared slot
+  kExchange,   // Swap a local handle with a shared slot
+  kSend,       // Push a local handle onto the shared queue
+  kReceive,    // Pop a handle from the shared queue
+  kMutate,     // Write the object through get_mut_if_unique
+  kOperations
+};
+
+static const char *const kOperationNames[kOperations] = {
+    "make",      "clone",  "copy_assign", "move_assign", "drop",
+    "downgrade", "upgrade", "try_upgrade", "weak_assign", "load",
+    "store",     "exchange", "send",      "receive",     "mutate"};
+
+/**
+ * @brief State shared by all threads.
+ *
+ * @tparam Count Counting policy of the handles. AtomicArc only holds
+ * `AtomicCount` Arcs, so under other policies the slots stay empty and the
+ * operations on them do nothing.
+ */
+template <typename Count> struct Shared {
+  static constexpr std::size_t kSlots = 16;
+  static constexpr bool kHasSlots = std::is_same_v<Count, AtomicCount>;
+
+  std::array<AtomicArc<Tracked>, kSlots> slots; // Handles any thread swaps
+  ArcQueue<Tracked, Count> queue;               // Handles passed on
+
+  void fill() {
+    if constexpr (kHasSlots) {
+      for (std::size_t i = 0; i < kSlots; ++i) {
+        slots[i].store(make(static_cast<long>(i)));
+      }
+    }
+  }
+};
+
+/**
+ * @brief One thread's handles, and the operations on them.
+ *
+ * @tparam Count Counting policy of the handles.
+ */
+template <typename Count> class Worker {
+private:
+  using Strong = Arc<Tracked, Count>;
+  using Weak = WeakArc<Tracked, Count>;
+
+  static constexpr std::size_t kHandles = 8;
+
+  Shared<Count> &shared;
+  Random random;
+  std::array<std::optional<Strong>, kHandles> strong;
+  std::array<std::optional<Weak>, kHandles> weak;
+
+  std::optional<Strong> &any_strong() { return strong[random.below(kHandles)]; }
+  std::optional<Weak> &any_weak() { return weak[random.below(kHandles)]; }
+  AtomicArc<Tracked> &any_slot() {
+    return shared.slots[random.below(Shared<Count>::kSlots)];
+  }
+
+  static void check(const Strong &handle) {
+    if (auto object = handle.get()) {
+      object->check();
+    }
+  }
+
+public:
+  Worker(Shared<Count> &shared, std::uint64_t seed)
+      : shared(shared), random(seed) {}
+
+  /**
+   * @brief Perform one operation on randomly chosen handles.
+   *
+   * @param operation The operation to perform.
+   */
+  void run(Operation operation) {
+    switch (operation) {
+    case kMake:
+      any_strong() = make<Count>(static_cast<long>(random.next()));
+      break;
+    case kClone: {
+      auto &from = any_strong();
+      if (from) {
+        check(*from);
+        any_strong() = from->clone();
+      }
+      break;
+    }
+    case kCopyAssign: {
+      auto &from = any_strong();
+      auto &to = any_strong();
+      if (from && to) {
+        *to = *from;
+        check(*to);
+      }
+      break;
+    }
+    case kMoveAssign: {
+      auto &from = any_strong();
+      auto &to = any_strong();
+      if (from && to && &from != &to) {
+        *to = std::move(*from);
+        from.reset();
+        check(*to);
+      }
+      break;
+    }
+    case kDrop:
+      any_strong().reset();
+      break;
+    case kDowngrade: {
+      auto &from = any_strong();
+      if (from) {
+        any_weak().emplace(*from);
+      }
+      break;
+    }
+    case kUpgrade: {
+      auto &from = any_weak();
+      if (from) {
+        auto upgraded = from->upgrade();
+        check(upgraded);
+        if (upgraded.get()) {
+          any_strong() = std::move(upgraded);
+        }
+      }
+      break;
+    }
+    case kTryUpgrade: {
+      auto &from = any_weak();
+      if (from) {
+        if (auto upgraded = from->try_upgrade()) {
+          if (!upgraded->get()) {
+            fail("try_upgrade returned an empty Arc");
+          }
+          check(*upgraded);
+        }
+      }
+      break;
+    }
+    case kWeakAssign: {
+      auto &from = any_weak();
+      auto &to = any_weak();
+      if (from && to) {
+        *to = *from;
+      }
+      break;
+    }
+    case kLoad:
+      if constexpr (Shared<Count>::kHasSlots) {
+        auto loaded = any_slot().load();
+        check(loaded);
+        if (loaded.get()) {
+          any_strong() = std::move(loaded);
+        }
+      }
+      break;
+    case kStore:
+      if constexpr (Shared<Count>::kHasSlots) {
+        auto &from = any_strong();
+        if (from) {
+          any_slot().store(*from);
+        }
+      }
+      break;
+    case kExchange:
+      if constexpr (Shared<Count>::kHasSlots) {
+        auto &local = any_strong();
+        if (local) {
+          auto old = any_slot().exchange(std::move(*local));
+          check(old);
+          if (old.get()) {
+            local = std::move(old);
+          } else {
+            local.reset();
+          }
+        }
+      }
+      break;
+    case kSend: {
+      auto &from = any_strong();
+      if (from) {
+        shared.queue.push(std::move(*from));
+        from.reset();
+      }
+      break;
+    }
+    case kReceive:
+      if (auto received = shared.queue.try_pop()) {
+        check(*received);
+        any_strong() = std::move(*received);
+      }
+      break;
+    case kMutate: {
+      auto &local = any_strong();
+      if (local) {
+        if (auto object = local->get_mut_if_unique()) {
+          // Unique ownership must exclude every other reader and writer, so
+          // TSan flags this plain write if the ordering is wrong.
+          object->get().check();
+          ++object->get().value;
+        } else {
+          check(*local);
+        }
+      }
+      break;
+    }
+    case kOperations:
+      break;
+    }
+  }
+
+  /**
+   * @brief Fill every handle, so that benchmarks of one operation have
+   * something to work on.
+   */
+  void fill() {
+    for (auto &handle : strong) {
+      handle = make<Count>(static_cast<long>(random.next()));
+    }
+    for (std::size_t i = 0; i < kHandles; ++i) {
+      weak[i].emplace(*strong[i]);
+    }
+  }
+
+  Random &rng() { return random; }
+};
+
+/**
+ * @brief Run `body` on `threads` threads, released together, and time it.
+ *
+ * @param threads Number of threads.
+ * @param body Called as body(thread_index) on each thread.
+ * @return Wall time of the slowest thread, in nanoseconds.
+ */
+template <typename Body> double run_threads(int threads, Body body) {
+  std::atomic<int> ready(0);
+  std::atomic<bool> go(false);
+  std::vector<std::thread> workers;
+  for (int t = 0; t < threads; ++t) {
+    workers.emplace_back([&, t]() {
+      ready.fetch_add(1);
+      while (!go.load(std::memory_order_acquire)) {
+        std::this_thread::yield();
+      }
+      body(t);
+    });
+  }
+  while (ready.load() != threads) {
+    std::this_thread::yield();
+  }
+  auto start = std::chrono::steady_clock::now();
+  go.store(true, std::memory_order_release);
+  for (auto &worker : workers) {
+    worker.join();
+  }
+  return std::chrono::duration<double, std::nano>(
+             std::chrono::steady_clock::now() - start)
+      .count();
+}
+
+/**
+ * @brief Report a phase that ran `operations` operations per thread.
+ */
+static void report(const char *name, double ns, long operations) {
+  std::printf("%-12s %10.2f ns/op\n", name,
+              ns / static_cast<double>(operations));
+}
+
+/**
+ * @brief Destroy everything the epoch and the reclaimer still hold, then
+ * check for leaks.
+ */
+static void check_leaks() {
+  // The reclaimer thread may still be destroying a batch it took off the
+  // queue, so wait a while for it before reporting a leak.
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+  for (;;) {
+    while (ArcEpoch::collect() != 0 || ArcReclaimer::reclaim() != 0) {
+    }
+    if ((live_objects.load() == 0 && live_blocks.load() == 0) ||
+        std::chrono::steady_clock::now() > deadline) {
+      break;
+    }
+    std::this_thread::yield();
+  }
+  if (live_objects.load() != 0) {
+    std::fprintf(stderr, "arc_stress: %ld objects leaked\n",
+                 live_objects.load());
+    failures.fetch_add(1);
+  }
+  if (live_blocks.load() != 0) {
+    std::fprintf(stderr, "arc_stress: %ld control blocks leaked\n",
+                 live_blocks.load());
+    failures.fetch_add(1);
+  }
+}
+
+/**
+ * @brief Run the random mix of operations on handles of one counting
+ * policy, then check for leaks.
+ *
+ * Under `BiasedCount`, handles sent through the queue are dropped on other
+ * threads than their owners, so the owners merge counts while other threads
+ * release their own references.
+ *
+ * @param name Name of the run in the report.
+ */
+template <typename Count>
+static void run_mixed(const char *name, int threads, long iterations,
+                      std::uint64_t seed) {
+  {
+    Shared<Count> shared;
+    auto ns = run_threads(threads, [&](int t) {
+      Worker<Count> worker(shared, seed + static_cast<std::uint64_t>(t));
+      for (long i = 0; i < iterations; ++i) {
+        worker.run(static_cast<Operation>(worker.rng().below(kOperations)));
+      }
+    });
+    report(name, ns, iterations);
+  }
+  check_leaks();
+}
+
+/**
+ * @brief Single-slot handoff of one handle between two threads.
+ */
+template <typename Handle> class Mailbox {
+private:
+  std::atomic<bool> full{false};
+  std::optional<Handle> value;
+
+public:
+  void put(Handle handle) {
+    while (full.load(std::memory_order_acquire)) {
+      std::this_thread::yield();
+    }
+    value.emplace(std::move(handle));
+    full.store(true, std::memory_order_release);
+  }
+
+  Handle take() {
+    while (!full.load(std::memory_order_acquire)) {
+      std::this_thread::yield();
+    }
+    Handle handle = std::move(*value);
+    value.reset();
+    full.store(false, std::memory_order_release);
+    return handle;
+  }
+};
+
+/**
+ * @brief Pass `BiasedCount` handles between pairs of threads so that an
+ * owner merges its counts while the other thread drops a clone of its own.
+ *
+ * The owner sends a clone, which still counts on the owner. The peer clones
+ * it on the shared count, sends the original back and drops its clone after
+ * a random delay. Meanwhile the owner drops both of its references, so its
+ * local count reaches zero and it merges. Nothing orders the peer's drop
+ * after the merge, so TSan flags a merge that still touches the block.
+ */
+static void run_biased_pass(int threads, long iterations,
+                               std::uint64_t seed) {
+  using Handle = Arc<Tracked, BiasedCount>;
+  {
+    std::vector<Mailbox<Handle>> to_peer(static_cast<std::size_t>(threads));
+    std::vector<Mailbox<Handle>> to_owner(static_cast<std::size_t>(threads));
+    auto ns = run_threads(threads, [&](int t) {
+      auto pair = static_cast<std::size_t>(t / 2);
+      if (t % 2 == 0 && t + 1 < threads) { // Owner
+        for (long i = 0; i < iterations; ++i) {
+          auto own = make<BiasedCount>(static_cast<long>(i));
+          to_peer[pair].put(own.clone());
+          auto back = to_owner[pair].take();
+          back.get()->check();
+        }
+      } else if (t % 2 == 1) { // Peer
+        Random random(seed + static_cast<std::uint64_t>(t));
+        for (long i = 0; i < iterations; ++i) {
+          auto received = to_peer[pair].take();
+          auto clone = received.clone();
+          to_owner[pair].put(std::move(received));
+          for (auto yields = random.below(4); yields != 0; --yields) {
+            std::this_thread::yield();
+            clone.get()->check();
+          }
+        }
+      }
+    });
+    report("biased_pass", ns, iterations);
+  }
+  check_leaks();
+}
+
+/**
+ * @brief Copy, clone, replace and drop `ShardedArc` handles on every
+ * thread, and pass them around a ring of threads, so that references taken
+ * on one thread's stripe are dropped on another's.
+ */
+static void run_sharded(int threads, long iterations, std::uint64_t seed) {
+  using Handle = ShardedArc<Tracked>;
+  {
+    auto root = make_sharded_arc<Tracked>(0);
+    std::vector<Mailbox<Handle>> ring(static_cast<std::size_t>(threads));
+    auto ns = run_threads(threads, [&](int t) {
+      Random random(seed + static_cast<std::uint64_t>(t));
+      std::array<std::optional<Handle>, 4> local;
+      for (long i = 0; i < iterations; ++i) {
+        auto &handle = local[random.below(local.size())];
+        switch (random.below(4)) {
+        case 0:
+          handle = root;
+          break;
+        case 1:
+          if (handle) {
+            local[random.below(local.size())] = handle->clone();
+          }
+          break;
+        case 2:
+          handle = make_sharded_arc<Tracked>(i);
+          break;
+        default:
+          handle.reset();
+          break;
+        }
+        if (handle) {
+          handle->get()->check();
+        }
+        if (i % 8 == 7) {
+          auto next = static_cast<std::size_t>((t + 1) % threads);
+          ring[next].put(handle ? std::move(*handle) : root);
+          handle = ring[static_cast<std::size_t>(t)].take();
+          handle->get()->check();
+        }
+      }
+    });
+    report("sharded", ns, iterations);
+  }
+  check_leaks();
+}
+
+/**
+ * @brief Borrow objects from shared `AtomicArc` slots while other threads
+ * replace them, so that the epoch retires objects that are still borrowed.
+ *
+ * Readers hold their borrows across yields, and also nest them inside
+ * `EpochPin`s of their own around a load.
+ */
+static void run_borrow(int threads, long iterations, std::uint64_t seed) {
+  auto make_borrowed = [](long value) {
+    return allocate_arc<Borrowed>(CountingAllocator<Borrowed>(), value);
+  };
+  {
+    std::array<AtomicArc<Borrowed>, 4> slots;
+    for (auto &slot : slots) {
+      slot.store(make_borrowed(0));
+    }
+    auto ns = run_threads(threads, [&](int t) {
+      Random random(seed + static_cast<std::uint64_t>(t));
+      for (long i = 0; i < iterations; ++i) {
+        auto &slot = slots[random.below(slots.size())];
+        switch (random.below(4)) {
+        case 0: {
+          auto guard = slot.borrow();
+          if (!guard) {
+            fail("borrowed from an empty slot");
+            break;
+          }
+          for (auto yields = random.below(3); yields != 0; --yields) {
+            std::this_thread::yield();
+            guard->check();
+          }
+          break;
+        }
+        case 1: {
+          EpochPin pin;
+          auto loaded = slot.load();
+          auto guard = slot.borrow();
+          loaded.get()->check();
+          guard->check();
+          break;
+        }
+        case 2:
+          slot.store(make_borrowed(i));
+          break;
+        default:
+          slot.exchange(make_borrowed(i)).get()->check();
+          break;
+        }
+      }
+    });
+    report("borrow", ns, iterations);
+  }
+  check_leaks();
+}
+
+/**
+ * @brief Push and pop on a shared `ArcStack` from every thread, so that
+ * objects are dropped on other threads than the ones that made them.
+ *
+ * Some pushes keep a clone, so a pop is not always the last reference.
+ */
+static void run_stack(int threads, long iterations, std::uint64_t seed) {
+  {
+    ArcStack<Tracked> stack;
+    auto ns = run_threads(threads, [&](int t) {
+      Random random(seed + static_cast<std::uint64_t>(t));
+      std::optional<Arc<Tracked>> kept;
+      for (long i = 0; i < iterations; ++i) {
+        if (random.below(2) == 0) {
+          auto arc = make(i);
+          if (random.below(4) == 0) {
+            kept = arc.clone();
+          }
+          stack.push(std::move(arc));
+        } else if (auto popped = stack.try_pop()) {
+          popped->get()->check();
+        }
+      }
+    });
+    report("stack", ns, iterations);
+  }
+  check_leaks();
+}
+
+/**
+ * @brief Push and pop on a small shared `BoundedArcQueue` from every
+ * thread, so that it runs full and empty all the time.
+ *
+ * A push into a full queue must leave its Arc untouched.
+ */
+static void run_bounded(int threads, long iterations, std::uint64_t seed) {
+  {
+    BoundedArcQueue<Tracked> queue(16);
+    auto ns = run_threads(threads, [&](int t) {
+      Random random(seed + static_cast<std::uint64_t>(t));
+      for (long i = 0; i < iterations; ++i) {
+        if (random.below(2) == 0) {
+          auto arc = make(i);
+          if (!queue.try_push(std::move(arc))) {
+            if (!arc.get()) {
+              fail("push into a full queue emptied its Arc");
+            } else {
+              arc.get()->check();
+            }
+          }
+        } else if (auto popped = queue.try_pop()) {
+          popped->get()->check();
+        }
+      }
+    });
+    report("bounded", ns, iterations);
+  }
+  check_leaks();
+}
+
+/**
+ * @brief Drop `ArcDeferredDestruction` objects on every thread, so that
+ * their final releases race to push onto the `ArcReclaimer` queue while
+ * its thread destroys earlier batches.
+ *
+ * Handles pass through an ArcQueue first, so the last reference is often
+ * dropped on another thread, and threads now and then drain the queue
+ * themselves alongside the reclaimer thread.
+ */
+static void run_deferred(int threads, long iterations, std::uint64_t seed) {
+  {
+    ArcQueue<Deferred> queue;
+    auto ns = run_threads(threads, [&](int t) {
+      Random random(seed + static_cast<std::uint64_t>(t));
+      for (long i = 0; i < iterations; ++i) {
+        auto arc = allocate_arc<Deferred>(CountingAllocator<Deferred>(), i);
+        if (random.below(2) == 0) {
+          queue.push(arc.clone());
+        }
+        if (auto received = queue.try_pop()) {
+          received->get()->check();
+        }
+        if (random.below(256) == 0) {
+          ArcReclaimer::reclaim();
+        }
+      }
+    });
+    report("deferred", ns, iterations);
+  }
+  check_leaks();
+}
+
+/**
+ * @brief Allocate from `ArcPool` on some threads and free on others, so
+ * that the freeing threads' lists overflow onto the global stack and the
+ * allocating threads refill from it.
+ *
+ * Small thread caches make both happen every few blocks.
+ */
+static void run_pool(int threads, long iterations) {
+  auto before = ArcPool::stats();
+  {
+    ArcQueue<Tracked> queue;
+    long producers = (threads + 1) / 2;
+    std::atomic<long> consumed(0);
+    auto ns = run_threads(threads, [&](int t) {
+      ArcPool::set_thread_cache_limit(8);
+      if (t % 2 == 0) {
+        for (long i = 0; i < iterations; ++i) {
+          queue.push(allocate_arc<Tracked>(ArcPoolAllocator<Tracked>(), i));
+        }
+        return;
+      }
+      while (consumed.load(std::memory_order_relaxed) <
+             producers * iterations) {
+        if (auto received = queue.try_pop()) {
+          received->get()->check();
+          consumed.fetch_add(1, std::memory_order_relaxed);
+        } else {
+          std::this_thread::yield();
+        }
+      }
+    });
+    report("pool", ns, iterations);
+  }
+  auto after = ArcPool::stats();
+  if (iterations > 64 &&
+      (after.drained == before.drained || after.refills == before.refills)) {
+    fail("pooled blocks never went through the global stack");
+  }
+  ArcPool::trim(); // Pooled memory would otherwise look leaked to LSan
+  check_leaks();
+}
+
+/**
+ * @brief Thrown by an Item copy that was set up to fail.
+ */
+struct CopyFailure {};
+
+// Copies left on this thread before an Item copy throws, or -1 for never.
+static thread_local long copies_before_throw = -1;
+
+/**
+ * @brief Element of the persistent containers under test. Its copies can be
+ * made to throw, and it counts as a live object until destroyed.
+ */
+struct Item {
+  long value;
+
+  explicit Item(long value) : value(value) {
+    live_objects.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  Item(const Item &other) : value(other.value) {
+    if (copies_before_throw >= 0 && copies_before_throw-- == 0) {
+      throw CopyFailure();
+    }
+    live_objects.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  Item(Item &&other) noexcept : value(other.value) {
+    live_objects.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  Item &operator=(const Item &other) = default;
+  Item &operator=(Item &&other) noexcept = default;
+
+  ~Item() { live_objects.fetch_sub(1, std::memory_order_relaxed); }
+};
+
+/**
+ * @brief Hash that maps every four consecutive keys to the same full hash,
+ * so that the map keeps entries past its last level.
+ */
+struct CollidingHash {
+  std::size_t operator()(long key) const {
+    return static_cast<std::size_t>(key / 4) * 0x9E3779B97F4A7C15ull;
+  }
+};
+
+using Vector = PersistentVector<Item>;
+using Map = PersistentMap<long, Item, CollidingHash>;
+using VectorModel = std::vector<long>;
+using MapModel = std::map<long, long>;
+
+static void check_vector(const Vector &vector, const VectorModel &model) {
+  if (vector.size() != model.size() || vector.empty() != model.empty()) {
+    fail("persistent vector has the wrong size");
+    return;
+  }
+  std::size_t index = 0;
+  vector.for_each([&](const Item &item) {
+    if (index >= model.size() || item.value != model[index]) {
+      fail("persistent vector differs from std::vector");
+    }
+    ++index;
+  });
+  for (std::size_t i = 0; i < model.size(); i += 1 + i / 8) {
+    if (vector[i].value != model[i] || vector.at(i).value != model[i]) {
+      fail("persistent vector index differs from std::vector");
+    }
+  }
+  if (!model.empty() && vector.back().value != model.back()) {
+    fail("persistent vector back differs from std::vector");
+  }
+}
+
+static void check_map(const Map &map, const MapModel &model, long keys) {
+  if (map.size() != model.size() || map.empty() != model.empty()) {
+    fail("persistent map has the wrong size");
+    return;
+  }
+  std::size_t entries = 0;
+  map.for_each([&](long key, const Item &item) {
+    auto found = model.find(key);
+    if (found == model.end() || found->second != item.value) {
+      fail("persistent map differs from std::map");
+    }
+    ++entries;
+  });
+  if (entries != model.size()) {
+    fail("persistent map visits the wrong number of entries");
+  }
+  for (long key = 0; key < keys; ++key) {
+    auto found = map.find(key);
+    auto expected = model.find(key);
+    if ((found != nullptr) != (expected != model.end()) ||
+        (found && found->value != expected->second)) {
+      fail("persistent map lookup differs from std::map");
+    }
+  }
+}
+
+/**
+ * @brief Apply random edits to a PersistentVector and a PersistentMap and
+ * the same edits to std::vector and std::map, and compare them.
+ *
+ * Edits go to the containers directly or through a Transient. They grow
+ * and shrink in turns, the shrinking turns down to empty. Snapshots taken
+ * along the way must keep their contents while later edits share and copy
+ * their nodes. Some edits have an element copy throw, and must then leave
+ * the container as it was.
+ *
+ * @param random Generator choosing the edits.
+ * @param edits Number of edits to make.
+ */
+static void check_persistent(Random &random, long edits) {
+  constexpr long kKeys = 512; // Keys drawn from 0 to kKeys - 1
+  Vector vector;
+  VectorModel vector_model;
+  Map map;
+  MapModel map_model;
+  std::optional<Vector::Transient> vector_transient;
+  std::optional<Map::Transient> map_transient;
+  std::vector<std::pair<Vector, VectorModel>> vector_snapshots;
+  std::vector<std::pair<Map, MapModel>> map_snapshots;
+  bool growing = false;
+
+  // Sometimes make one of the next few element copies throw.
+  auto arm = [&]() {
+    copies_before_throw =
+        random.below(16) == 0 ? static_cast<long>(random.below(48)) : -1;
+  };
+
+  for (long edit = 0; edit < edits; ++edit) {
+    if (edit % 1000 == 0) {
+      growing = !growing;
+    }
+    if (random.below(64) == 0) {
+      if (vector_transient) {
+        vector = std::move(*vector_transient).persistent();
+        map = std::move(*map_transient).persistent();
+        vector_transient.reset();
+        map_transient.reset();
+      } else {
+        vector_transient.emplace(vector.transient());
+        map_transient.emplace(map.transient());
+      }
+    }
+    if (random.below(128) == 0 && !vector_transient) {
+      if (vector_snapshots.size() == 8) {
+        vector_snapshots.erase(vector_snapshots.begin());
+        map_snapshots.erase(map_snapshots.begin());
+      }
+      vector_snapshots.emplace_back(vector, vector_model);
+      map_snapshots.emplace_back(map, map_model);
+    }
+
+    // Grows three times in four while growing, once in four otherwise.
+    bool grow = random.below(4) != 0 ? growing : !growing;
+    auto value = static_cast<long>(random.next() >> 1);
+    auto key = static_cast<long>(random.below(kKeys));
+    Item item(value);
+
+    arm();
+    try {
+      if (grow) {
+        if (vector_transient) {
+          vector_transient->push_back(item);
+        } else if (random.below(2) == 0) {
+          vector = vector.push_back(item);
+        } else {
+          vector = std::move(vector).push_back(item);
+        }
+        vector_model.push_back(value);
+      } else if (!vector_model.empty() && random.below(3) == 0) {
+        auto index = random.below(vector_model.size());
+        if (vector_transient) {
+          vector_transient->set(index, item);
+        } else {
+          vector = vector.set(index, item);
+        }
+        vector_model[index] = value;
+      } else if (!vector_model.empty()) {
+        if (vector_transient) {
+          vector_transient->pop_back();
+        } else if (random.below(2) == 0) {
+          vector = vector.pop_back();
+        } else {
+          vector = std::move(vector).pop_back();
+        }
+        vector_model.pop_back();
+      }
+    } catch (const CopyFailure &) {
+    }
+
+    arm();
+    try {
+      if (grow) {
+        if (map_transient) {
+          map_transient->set(key, item);
+        } else if (random.below(2) == 0) {
+          map = map.set(key, item);
+        } else {
+          map = std::move(map).set(key, item);
+        }
+        map_model[key] = value;
+      } else {
+        if (map_transient) {
+          map_transient->erase(key);
+        } else {
+          map = map.erase(key);
+        }
+        map_model.erase(key);
+      }
+    } catch (const CopyFailure &) {
+    }
+    copies_before_throw = -1;
+
+    if (vector_transient) {
+      if (vector_transient->size() != vector_model.size() ||
+          map_transient->size() != map_model.size()) {
+        fail("transient has the wrong size");
+      }
+      continue;
+    }
+    check_vector(vector, vector_model);
+    if (edit % 16 == 0) {
+      check_map(map, map_model, kKeys);
+    }
+    if (edit % 256 == 0) {
+      for (auto &snapshot : vector_snapshots) {
+        check_vector(snapshot.first, snapshot.second);
+      }
+      for (auto &snapshot : map_snapshots) {
+        check_map(snapshot.first, snapshot.second, kKeys);
+      }
+    }
+  }
+}
+
+/**
+ * @brief Check the persistent containers on every thread at once, each
+ * thread with containers of its own.
+ */
+static void run_persistent(int threads, long iterations, std::uint64_t seed) {
+  auto ns = run_threads(threads, [&](int t) {
+    Random random(seed + static_cast<std::uint64_t>(t));
+    check_persistent(random, iterations / 8);
+  });
+  std::printf("%-12s %10.2f ns/edit\n", "persistent",
+              ns / static_cast<double>(iterations / 8));
+  check_leaks();
+}
+
+int main(int argc, char **argv) {
+  int threads = static_cast<int>(std::thread::hardware_concurrency());
+  long iterations = 200000;
+  std::uint64_t seed = static_cast<std::uint64_t>(
+      std::chrono::steady_clock::now().time_since_epoch().count());
+  if (argc > 1) {
+    threads = std::atoi(argv[1]);
+  }
+  if (argc > 2) {
+    iterations = std::atol(argv[2]);
+  }
+  if (argc > 3) {
+    seed = std::strtoull(argv[3], nullptr, 10);
+  }
+  threads = std::max(threads, 2);
+  std::printf("threads %d, iterations %ld, seed %llu\n", threads, iterations,
+              static_cast<unsigned long long>(seed));
+
+  // Mixed runs: every thread picks a random operation each iteration.
+  run_mixed<AtomicCount>("mixed", threads, iterations, seed);
+  run_mixed<BiasedCount>("mixed_biased", threads, iterations, seed);
+  run_mixed<PackedAtomicCount<>>("mixed_packed", threads, iterations, seed);
+  run_biased_pass(threads, iterations, seed);
+
+  // The other lock-free paths, each on its own.
+  run_sharded(threads, iterations, seed);
+  run_borrow(threads, iterations, seed);
+  run_stack(threads, iterations, seed);
+  run_bounded(threads, iterations, seed);
+  run_deferred(threads, iterations, seed);
+  run_pool(threads, iterations);
+
+  // One operation at a time, on handles filled up front. Operations that
+  // empty a handle would soon run out of work on their own, so drops are
+  // measured as part of make, and a send is paired with a receive.
+  std::printf("%-12s %10s\n", "operation", "ns/op");
+  for (int op = 0; op < kOperations; ++op) {
+    auto operation = static_cast<Operation>(op);
+    if (operation == kDrop || operation == kMoveAssign ||
+        operation == kReceive) {
+      continue;
+    }
+    Shared<AtomicCount> shared;
+    shared.fill();
+    auto ns = run_threads(threads, [&](int t) {
+      Worker<AtomicCount> worker(shared, seed + static_cast<std::uint64_t>(t));
+      worker.fill();
+      for (long i = 0; i < iterations; ++i) {
+        worker.run(operation);
+        if (operation == kSend) {
+          worker.run(kReceive);
+        }
+      }
+    });
+    std::printf("%-12s %10.2f\n",
+                operation == kSend ? "send_receive" : kOperationNames[op],
+                ns / static_cast<double>(iterations));
+  }
+  check_leaks();
+
+  // Deep lists, dropped whole and popped one node at a time by move
+  // assigning each node's successor over the handle that owns the node.
+  {
+    constexpr long kListLength = 1000000;
+    auto ns = run_threads(threads, [&](int) {
+      {
+        auto whole = make_list(kListLength);
+      }
+      std::optional<Arc<ListNode>> head = make_list(kListLength);
+      while (head) {
+        head->get()->item.check();
+        head = std::move(head->get()->next);
+      }
+    });
+    std::printf("%-12s %10.2f ns/node\n", "deep_list",
+                ns / static_cast<double>(2 * kListLength));
+  }
+  check_leaks();
+
+  run_persistent(threads, iterations, seed);
+
+  if (failures.load() != 0) {
+    std::printf("FAILED: %ld checks\n", failures.load());
+    return 1;
+  }
+  std::printf("passed\n");
+  return 0;
+}